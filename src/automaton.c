@@ -1,71 +1,223 @@
 #include "automaton.h"
 
 #include "serialization.h"
+#include "species.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <string.h>
 
-#define ACTION_RESOLUTION 1024
-
 static unsigned short rand_action(const settings_t *settings, MTRand *rand) {
   if ((settings->flags & F_DETERMINISTIC) == 0) {
-    return genRandLong(rand)%(ACTION_RESOLUTION + 1);
+    return genRandBounded(rand, ACTION_RESOLUTION + 1);
   } else {
-    return (genRandLong(rand) & 1) * ACTION_RESOLUTION;
+    return genRandBounded(rand, 2) * ACTION_RESOLUTION;
   }
 }
 
 static void state_init(state_t *st, const settings_t *settings, MTRand *rand) {
   st->action = rand_action(settings, rand);
   for (int i = 0; i < 8; ++i) {
-    st->next_tab[i] = genRandLong(rand)%settings->state_n;
+    st->next_tab[i] = genRandBounded(rand, settings->state_n);
   }
 }
 
-void automaton_init(automaton_t *a, const settings_t *settings, MTRand *rand) {
-  a->score    = 0;
-  a->state_n  = settings->state_n;
-  a->lifetime = genRandLong(rand) % settings->lifetime;
-  a->status   = A_ST_ALIVE;
-  a->color    = genRandLong(rand) & 0xFFFFFF;
-  a->states   = malloc(sizeof(state_t) * a->state_n);
+/* Sets up handles of genomes and play tables */
+static void population_link(population_t *pop) {
+  for (int i = 0; i < pop->size; ++i) {
+    pop->genome[i] = &pop->states[(size_t)i * pop->state_n];
+    pop->play[i]   = &pop->play_states[(size_t)i * pop->state_n];
+  }
+}
 
-  for (int i = 0; i < (int)a->state_n; ++i) {
-    state_init(&a->states[i], settings, rand);
+void population_init(population_t *pop, int size, int state_n) {
+  pop->size     = size;
+  pop->state_n  = state_n;
+  pop->mapped   = 0;
+  pop->score    = malloc(sizeof(int) * size);
+  pop->status   = malloc(sizeof(char) * size);
+  pop->lifetime = malloc(sizeof(unsigned short) * size);
+  pop->color    = malloc(sizeof(unsigned) * size);
+  pop->id       = malloc(sizeof(uint64_t) * size);
+  pop->genome   = malloc(sizeof(state_t *) * size);
+  pop->states   = malloc(sizeof(state_t) * state_n * size);
+  pop->play        = malloc(sizeof(state_t *) * size);
+  pop->play_states = malloc(sizeof(state_t) * state_n * size);
+  pop->hash        = malloc(sizeof(uint64_t) * size);
+  pop->species     = malloc(sizeof(uint64_t) * size);
+  pop->simhash     = malloc(sizeof(uint64_t) * size);
+  population_link(pop);
+  for (int i = 0; i < size; ++i) {
+    pop->score[i]  = 0;
+    pop->status[i] = A_ST_ALIVE;
   }
 }
 
-void automaton_destroy(automaton_t *a) {
-  free(a->states);
+#define POP_ALIGN(x) (((x) + 63) & ~(size_t)63)
+
+enum {
+  POP_SCORE, POP_STATUS, POP_LIFETIME, POP_COLOR, POP_ID, POP_STATES,
+  POP_PLAY_STATES, POP_HASH, POP_SPECIES, POP_SIMHASH, POP_FIELD_N
+};
+
+/* Offsets of arrays of a population placed in one block of memory, and
+ * the size of the block */
+static size_t population_offsets(int size, int state_n, size_t *offset) {
+  size_t n = size;
+  size_t field_size[POP_FIELD_N] = {
+    sizeof(int) * n, sizeof(char) * n, sizeof(unsigned short) * n,
+    sizeof(unsigned) * n, sizeof(uint64_t) * n,
+    sizeof(state_t) * state_n * n, sizeof(state_t) * state_n * n,
+    sizeof(uint64_t) * n, sizeof(uint64_t) * n, sizeof(uint64_t) * n
+  };
+  size_t total = 0;
+  for (int f = 0; f < POP_FIELD_N; ++f) {
+    offset[f] = total;
+    total    += POP_ALIGN(field_size[f]);
+  }
+  return total;
 }
 
-void automaton_reset(automaton_t *a) {
-  a->score  = 0;
-  a->status = A_ST_ALIVE;
-  if (a->lifetime > 0) {
-    a->lifetime--;
+size_t population_layout(int size, int state_n) {
+  size_t offset[POP_FIELD_N];
+  return population_offsets(size, state_n, offset);
+}
+
+/* Places the population in the given block, of population_layout() bytes,
+ * keeping automata that are already there, with their scores and statuses
+ * (a new block is zeroed, i.e., holds fresh ones) */
+void population_map(population_t *pop, int size, int state_n, void *base) {
+  size_t offset[POP_FIELD_N];
+  char  *b = base;
+  population_offsets(size, state_n, offset);
+  pop->size        = size;
+  pop->state_n     = state_n;
+  pop->mapped      = 1;
+  pop->score       = (int *)(b + offset[POP_SCORE]);
+  pop->status      = b + offset[POP_STATUS];
+  pop->lifetime    = (unsigned short *)(b + offset[POP_LIFETIME]);
+  pop->color       = (unsigned *)(b + offset[POP_COLOR]);
+  pop->id          = (uint64_t *)(b + offset[POP_ID]);
+  pop->states      = (state_t *)(b + offset[POP_STATES]);
+  pop->play_states = (state_t *)(b + offset[POP_PLAY_STATES]);
+  pop->hash        = (uint64_t *)(b + offset[POP_HASH]);
+  pop->species     = (uint64_t *)(b + offset[POP_SPECIES]);
+  pop->simhash     = (uint64_t *)(b + offset[POP_SIMHASH]);
+  pop->genome      = malloc(sizeof(state_t *) * size);
+  pop->play        = malloc(sizeof(state_t *) * size);
+  population_link(pop);
+}
+
+void population_destroy(population_t *pop) {
+  free(pop->genome);
+  free(pop->play);
+  if (pop->mapped) {
+    return;
   }
+  free(pop->score);
+  free(pop->status);
+  free(pop->lifetime);
+  free(pop->color);
+  free(pop->id);
+  free(pop->states);
+  free(pop->play_states);
+  free(pop->hash);
+  free(pop->species);
+  free(pop->simhash);
 }
 
-void automaton_play(
-  automaton_t       *a1,
-  automaton_t       *a2,
-  const settings_t  *settings,
-  MTRand            *rand)
+/* Places genomes in the storage in the given order of automata */
+void population_arrange(population_t *pop, const int *order) {
+  for (int t = 0; t < pop->size; ++t) {
+    pop->genome[order[t]] = &pop->states[(size_t)t * pop->state_n];
+    pop->play[order[t]]   = &pop->play_states[(size_t)t * pop->state_n];
+  }
+}
+
+/* Scores are reset only for automata marked in dirty (or for all of them,
+ * if it is NULL) */
+void population_reset(population_t *pop, const int *dirty) {
+  for (int i = 0; i < pop->size; ++i) {
+    if (dirty == NULL || dirty[i]) {
+      pop->score[i] = 0;
+    }
+    pop->status[i] = A_ST_ALIVE;
+  }
+  for (int i = 0; i < pop->size; ++i) {
+    pop->lifetime[i] -= (pop->lifetime[i] > 0);
+  }
+}
+
+void automaton_init(
+  population_t     *pop,
+  int               i,
+  const settings_t *settings,
+  MTRand           *rand)
 {
+  pop->score[i]    = 0;
+  pop->lifetime[i] = genRandBounded(rand, settings->lifetime);
+  pop->status[i]   = A_ST_ALIVE;
+  pop->color[i]    = genRandLong(rand) & 0xFFFFFF;
+
+  for (int k = 0; k < pop->state_n; ++k) {
+    state_init(&pop->genome[i][k], settings, rand);
+  }
+  automaton_compact(pop, i, settings);
+}
+
+/* Plays a game of i against j, and returns the score of i. The score of
+ * j is stored in score_j. Turns are recorded in trace, unless it is NULL;
+ * the function is inlined in both kernels below, so that the one that
+ * does not record pays nothing for it. */
+static inline __attribute__((always_inline)) int play_game(
+  const population_t *pop,
+  int                 i,
+  int                 j,
+  const settings_t   *settings,
+  MTRand             *rand,
+  int                *score_j,
+  transcript_turn_t  *trace)
+{
+  const state_t *g1 = pop->play[i];
+  const state_t *g2 = pop->play[j];
+  /* the payoff does not depend on the game history, so it is enough to
+   * count outcomes here and look them up in the matrix once at the end */
+  int outcome[4] = { 0, 0, 0, 0 };
   int s1 = 0;
   int s2 = 0;
-  for (int i = 0; i < settings->turn_n; i++) {
-    int err1 = (genRandFixed(rand) < settings->mistake_rate ? 1 : 0);
-    int err2 = (genRandFixed(rand) < settings->mistake_rate ? 1 : 0);
-    int dec1 =
-      (genRandLong(rand)%ACTION_RESOLUTION < a1->states[s1].action ? 1 : 0);
-    int dec2 =
-      (genRandLong(rand)%ACTION_RESOLUTION < a2->states[s2].action ? 1 : 0);
+  /* mistakes are rare, so instead of testing each move we count down
+   * the moves (of both players, alternately) left before the next one */
+  unsigned long next_err = genRandGap(rand, settings->mistake_rate);
+  for (int t = 0; t < settings->turn_n; t++) {
+    int err1 = 0;
+    int err2 = 0;
+    if (next_err == 0) {
+      err1 = 1;
+      next_err = genRandGap(rand, settings->mistake_rate);
+    } else {
+      next_err--;
+    }
+    if (next_err == 0) {
+      err2 = 1;
+      next_err = genRandGap(rand, settings->mistake_rate);
+    } else {
+      next_err--;
+    }
+    int dec1 = (genRandBounded(rand, ACTION_RESOLUTION) < g1[s1].action);
+    int dec2 = (genRandBounded(rand, ACTION_RESOLUTION) < g2[s2].action);
     int act1 = err1 ^ dec1;
     int act2 = err2 ^ dec2;
-    a1->score += 3*act2 - act1;
-    a2->score += 3*act1 - act2;
+    outcome[PAYOFF(act1, act2)]++;
+    if (trace != NULL) {
+      trace[t].state[0] = s1;
+      trace[t].state[1] = s2;
+      trace[t].move[0]  = dec1 * TRANSCRIPT_DECISION
+                        | err1 * TRANSCRIPT_MISTAKE
+                        | act1 * TRANSCRIPT_ACTION;
+      trace[t].move[1]  = dec2 * TRANSCRIPT_DECISION
+                        | err2 * TRANSCRIPT_MISTAKE
+                        | act2 * TRANSCRIPT_ACTION;
+    }
     if ((settings->flags & F_MISTAKE_AWARE) == 0) {
       err1 = 0;
       err2 = 0;
@@ -74,13 +226,87 @@ void automaton_play(
       dec1 = 0;
       dec2 = 0;
     }
-    s1 = a1->states[s1].next[err1][dec1][act2];
-    s2 = a2->states[s2].next[err2][dec2][act1];
+    s1 = g1[s1].next[err1][dec1][act2];
+    s2 = g2[s2].next[err2][dec2][act1];
+  }
+  const int *payoff = settings->payoff;
+  *score_j = outcome[PAYOFF_P] * payoff[PAYOFF_P]
+           + outcome[PAYOFF_T] * payoff[PAYOFF_S]
+           + outcome[PAYOFF_S] * payoff[PAYOFF_T]
+           + outcome[PAYOFF_R] * payoff[PAYOFF_R];
+  return outcome[PAYOFF_P] * payoff[PAYOFF_P]
+       + outcome[PAYOFF_T] * payoff[PAYOFF_T]
+       + outcome[PAYOFF_S] * payoff[PAYOFF_S]
+       + outcome[PAYOFF_R] * payoff[PAYOFF_R];
+}
+
+int automaton_game(
+  const population_t *pop,
+  int                 i,
+  int                 j,
+  const settings_t   *settings,
+  MTRand             *rand,
+  int                *score_j)
+{
+  return play_game(pop, i, j, settings, rand, score_j, NULL);
+}
+
+/* The same game, with its turns recorded in trace */
+int automaton_game_traced(
+  const population_t *pop,
+  int                 i,
+  int                 j,
+  const settings_t   *settings,
+  MTRand             *rand,
+  int                *score_j,
+  transcript_turn_t  *trace)
+{
+  return play_game(pop, i, j, settings, rand, score_j, trace);
+}
+
+void automaton_play(
+  population_t     *pop,
+  int               i,
+  int               j,
+  const settings_t *settings,
+  MTRand           *rand)
+{
+  int score_j;
+  pop->score[i] += play_game(pop, i, j, settings, rand, &score_j, NULL);
+  pop->score[j] += score_j;
+}
+
+/* Returns the score of i in a game against j, when automata are
+ * deterministic and make no mistakes. No random numbers are drawn, and
+ * since the game is symmetric, j would score the same against i. */
+int automaton_play_det(
+  const population_t *pop,
+  int                 i,
+  int                 j,
+  const settings_t   *settings)
+{
+  const state_t *g1 = pop->play[i];
+  const state_t *g2 = pop->play[j];
+  int aware = (settings->flags & F_DECISION_AWARE) != 0;
+  int outcome[4] = { 0, 0, 0, 0 };
+  int s1 = 0;
+  int s2 = 0;
+  for (int t = 0; t < settings->turn_n; t++) {
+    int act1 = (g1[s1].action != 0);
+    int act2 = (g2[s2].action != 0);
+    outcome[PAYOFF(act1, act2)]++;
+    s1 = g1[s1].next[0][aware & act1][act2];
+    s2 = g2[s2].next[0][aware & act2][act1];
   }
+  const int *payoff = settings->payoff;
+  return outcome[PAYOFF_P] * payoff[PAYOFF_P]
+       + outcome[PAYOFF_T] * payoff[PAYOFF_T]
+       + outcome[PAYOFF_S] * payoff[PAYOFF_S]
+       + outcome[PAYOFF_R] * payoff[PAYOFF_R];
 }
 
 static unsigned mutate_color(unsigned c, MTRand *rand) {
-  int x = genRandLong(rand) % 27;
+  int x = genRandBounded(rand, 27);
   int r = (c & 0xFF) + x % 3 - 1;
   int g = ((c >> 8)  & 0xFF) + (x / 3) % 3 - 1;
   int b = ((c >> 16) & 0xFF) + (x / 9) - 1;
@@ -91,93 +317,101 @@ static unsigned mutate_color(unsigned c, MTRand *rand) {
 }
 
 void automaton_cross(
-  automaton_t       *a,
-  const automaton_t *p1,
-  const automaton_t *p2,
-  const settings_t  *settings,
-  MTRand            *rand)
+  population_t     *pop,
+  int               i,
+  int               p1,
+  int               p2,
+  const settings_t *settings,
+  MTRand           *rand)
 {
-  int i;
-  assert(a->state_n == p1->state_n && a->state_n == p2->state_n);
-  a->lifetime = genRandLong(rand) % settings->lifetime;
+  state_t       *a  = pop->genome[i];
+  const state_t *g1 = pop->genome[p1];
+  const state_t *g2 = pop->genome[p2];
+  unsigned long  n  = pop->state_n;
+  unsigned long  k;
+  pop->lifetime[i] = genRandBounded(rand, settings->lifetime);
   if (genRandFixed(rand) < settings->cross_rate) {
-    a->color = mutate_color(
-      (genRandLong(rand) % 2 == 0 ? p1->color : p2->color),
+    pop->color[i] = mutate_color(
+      (genRandBounded(rand, 2) == 0 ? pop->color[p1] : pop->color[p2]),
       rand);
-    for (i = 0; i < (int)a->state_n; ++i) {
-      a->states[i] =
-        (genRandLong(rand) % 2 == 0 ? p1->states[i] : p2->states[i]);
+    for (k = 0; k < n; ++k) {
+      a[k] = (genRandBounded(rand, 2) == 0 ? g1[k] : g2[k]);
     }
   } else {
-    a->color = mutate_color(p1->color, rand);
-    for (i = 0; i < (int)a->state_n; ++i) {
-      a->states[i] = p1->states[i];
+    pop->color[i] = mutate_color(pop->color[p1], rand);
+    if (a != g1) {
+      memcpy(a, g1, sizeof(state_t) * n);
     }
   }
-  for (i = 0; i < (int)a->state_n; ++i) {
-    if (genRandFixed(rand) < settings->state_mut_rate) {
-      state_init(&a->states[i], settings, rand);
-      continue;
-    }
-    if (genRandFixed(rand) < settings->action_mut_rate) {
-      a->states[i].action = rand_action(settings, rand);
-    }
-    for (int j = 0; j < 8; ++j) {
-      if (genRandFixed(rand) < settings->edge_mut_rate) {
-        a->states[i].next_tab[j] = genRandLong(rand) % a->state_n;
-      }
-    }
+  /* mutations are rare, so we jump straight from one mutated gene to the
+   * next one. Actions and edges are mutated before whole states: a state
+   * replaced later forgets them, exactly as if they were never tested. */
+  for (k = genRandGap(rand, settings->action_mut_rate); k < n;
+    k += genRandGap(rand, settings->action_mut_rate) + 1)
+  {
+    a[k].action = rand_action(settings, rand);
+  }
+  for (k = genRandGap(rand, settings->edge_mut_rate); k < 8*n;
+    k += genRandGap(rand, settings->edge_mut_rate) + 1)
+  {
+    a[k / 8].next_tab[k % 8] = genRandBounded(rand, n);
   }
+  for (k = genRandGap(rand, settings->state_mut_rate); k < n;
+    k += genRandGap(rand, settings->state_mut_rate) + 1)
+  {
+    state_init(&a[k], settings, rand);
+  }
+  automaton_compact(pop, i, settings);
 }
 
 static void find_reachable_states(
-  const automaton_t *a,
-  const settings_t  *settings,
-  unsigned short *reachable)
+  const state_t    *states,
+  const settings_t *settings,
+  unsigned short   *reachable)
 {
   int st = 0;
   int next;
   reachable[st] = 1;
   while (1) {
     if ((settings->flags & F_DECISION_AWARE) == 0) {
-      next = a->states[st].next[0][0][0];
+      next = states[st].next[0][0][0];
       if (reachable[next] == 0) goto go_down;
-      next = a->states[st].next[0][0][1];
+      next = states[st].next[0][0][1];
       if (reachable[next] == 0) goto go_down;
       if ((settings->flags & F_MISTAKE_AWARE)
         && settings->mistake_rate > 0.0)
       {
-        next = a->states[st].next[1][0][0];
+        next = states[st].next[1][0][0];
         if (reachable[next] == 0) goto go_down;
-        next = a->states[st].next[1][0][1];
+        next = states[st].next[1][0][1];
         if (reachable[next] == 0) goto go_down;
       }
     } else {
-      if (a->states[st].action != 0) {
-        next = a->states[st].next[0][1][0];
+      if (states[st].action != 0) {
+        next = states[st].next[0][1][0];
         if (reachable[next] == 0) goto go_down;
-        next = a->states[st].next[0][1][1];
+        next = states[st].next[0][1][1];
         if (reachable[next] == 0) goto go_down;
         if ((settings->flags & F_MISTAKE_AWARE)
           && settings->mistake_rate > 0.0)
         {
-          next = a->states[st].next[1][1][0];
+          next = states[st].next[1][1][0];
           if (reachable[next] == 0) goto go_down;
-          next = a->states[st].next[1][1][1];
+          next = states[st].next[1][1][1];
           if (reachable[next] == 0) goto go_down;
         }
       }
-      if (a->states[st].action != ACTION_RESOLUTION) {
-        next = a->states[st].next[0][0][0];
+      if (states[st].action != ACTION_RESOLUTION) {
+        next = states[st].next[0][0][0];
         if (reachable[next] == 0) goto go_down;
-        next = a->states[st].next[0][0][1];
+        next = states[st].next[0][0][1];
         if (reachable[next] == 0) goto go_down;
         if ((settings->flags & F_MISTAKE_AWARE)
           && settings->mistake_rate > 0.0)
         {
-          next = a->states[st].next[1][0][0];
+          next = states[st].next[1][0][0];
           if (reachable[next] == 0) goto go_down;
-          next = a->states[st].next[1][0][1];
+          next = states[st].next[1][0][1];
           if (reachable[next] == 0) goto go_down;
         }
       }
@@ -191,72 +425,150 @@ go_down:
   }
 }
 
+/* Redirects edges that are never taken in games to the ones that are, so
+ * that automata differing only in them have equal play tables */
+void automaton_canonicalise(
+  state_t          *states,
+  int               n,
+  const settings_t *settings)
+{
+  int mistakes = (settings->flags & F_MISTAKE_AWARE)
+              && settings->mistake_rate > 0;
+  int aware    = (settings->flags & F_DECISION_AWARE) != 0;
+  for (int k = 0; k < n; ++k) {
+    state_t *st = &states[k];
+    for (int dec = 0; dec < 2; ++dec) {
+      for (int opp = 0; opp < 2; ++opp) {
+        if (!mistakes) {
+          st->next[1][dec][opp] = st->next[0][dec][opp];
+        }
+      }
+    }
+    for (int err = 0; err < 2; ++err) {
+      for (int opp = 0; opp < 2; ++opp) {
+        if (!aware || st->action == 0) {
+          st->next[err][1][opp] = st->next[err][0][opp];
+        } else if (st->action == ACTION_RESOLUTION) {
+          st->next[err][0][opp] = st->next[err][1][opp];
+        }
+      }
+    }
+  }
+}
+
+/* FNV-1a hash of a table of states */
+static uint64_t states_hash(const state_t *states, int n) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (int k = 0; k < n; ++k) {
+    h = (h ^ states[k].action) * 0x100000001b3ull;
+    for (int e = 0; e < 8; ++e) {
+      h = (h ^ states[k].next_tab[e]) * 0x100000001b3ull;
+    }
+  }
+  return h;
+}
+
+/* Copies the states reachable during a game to the play table, keeping
+ * their order. Edges that are never taken lead to the initial state. */
+void automaton_compact(
+  population_t     *pop,
+  int               i,
+  const settings_t *settings)
+{
+  const state_t  *states = pop->genome[i];
+  state_t        *play   = pop->play[i];
+  int             n      = pop->state_n;
+  unsigned short  map[MAX_STATE_N];  /* 20 kB, well within thread stacks */
+  memset(map, 0, sizeof(unsigned short) * n);
+
+  find_reachable_states(states, settings, map);
+  int m = 0;
+  for (int k = 0; k < n; ++k) {
+    map[k] = (map[k] ? m++ : 0);
+  }
+  for (int k = 0; k < n; ++k) {
+    if (k > 0 && map[k] == 0) {
+      continue;
+    }
+    play[map[k]].action = states[k].action;
+    for (int e = 0; e < 8; ++e) {
+      play[map[k]].next_tab[e] = map[states[k].next_tab[e]];
+    }
+  }
+  pop->hash[i] = states_hash(play, m);
+  if (settings->flags & F_SPECIES_BEHAVE) {
+    species_identify(play, m, settings, &pop->species[i], &pop->simhash[i]);
+  }
+}
+
 void automaton_print(
-  FILE              *file,
-  const settings_t  *settings,
-  const automaton_t *a)
+  FILE               *file,
+  const settings_t   *settings,
+  const population_t *pop,
+  int                 a)
 {
   int i;
-  unsigned short *reachable = malloc(sizeof(unsigned short) * a->state_n);
-  memset(reachable, 0, sizeof(unsigned short) * a->state_n);
+  const state_t *states = pop->genome[a];
+  unsigned short *reachable = malloc(sizeof(unsigned short) * pop->state_n);
+  memset(reachable, 0, sizeof(unsigned short) * pop->state_n);
 
-  find_reachable_states(a, settings, reachable);
+  find_reachable_states(states, settings, reachable);
 
   fprintf(file, "digraph automaton {\n");
   fprintf(file, "  node [shape = doublecircle, label = \"S%0.3f\"] ST_0;\n",
-    (float)a->states[0].action / ACTION_RESOLUTION);
-  for (i = 1; i < a->state_n; ++i) {
+    (float)states[0].action / ACTION_RESOLUTION);
+  for (i = 1; i < pop->state_n; ++i) {
     if ((settings->flags & F_SHOW_UNREACHABLE) == 0 && !reachable[i]) {
       continue;
     }
     fprintf(file, "  node [shape = circle, label = \"%0.3f\"] ST_%d;\n",
-      (float)a->states[i].action / ACTION_RESOLUTION,
+      (float)states[i].action / ACTION_RESOLUTION,
       i);
   }
-  for (i = 0; i < a->state_n; ++i) {
+  for (i = 0; i < pop->state_n; ++i) {
     if ((settings->flags & F_SHOW_UNREACHABLE) == 0 && !reachable[i]) {
       continue;
     }
     if ((settings->flags & F_DECISION_AWARE) == 0) {
       fprintf(file, "  ST_%d -> ST_%d [label = \"@0\"];\n",
-        i, (int)a->states[i].next[0][0][0]);
+        i, (int)states[i].next[0][0][0]);
       fprintf(file, "  ST_%d -> ST_%d [label = \"@1\"];\n",
-        i, (int)a->states[i].next[0][0][1]);
+        i, (int)states[i].next[0][0][1]);
       if ((settings->flags & F_MISTAKE_AWARE)
         && settings->mistake_rate > 0.0)
       {
         fprintf(file, "  ST_%d -> ST_%d [label = \"#0\"];\n",
-          i, (int)a->states[i].next[1][0][0]);
+          i, (int)states[i].next[1][0][0]);
         fprintf(file, "  ST_%d -> ST_%d [label = \"#1\"];\n",
-          i, (int)a->states[i].next[1][0][1]);
+          i, (int)states[i].next[1][0][1]);
       }
     } else {
-      if (a->states[i].action != 0) {
+      if (states[i].action != 0) {
         fprintf(file, "  ST_%d -> ST_%d [label = \"@10\"];\n",
-          i, (int)a->states[i].next[0][1][0]);
+          i, (int)states[i].next[0][1][0]);
         fprintf(file, "  ST_%d -> ST_%d [label = \"@11\"];\n",
-          i, (int)a->states[i].next[0][1][1]);
+          i, (int)states[i].next[0][1][1]);
         if ((settings->flags & F_MISTAKE_AWARE)
           && settings->mistake_rate > 0.0)
         {
           fprintf(file, "  ST_%d -> ST_%d [label = \"#10\"];\n",
-            i, (int)a->states[i].next[1][1][0]);
+            i, (int)states[i].next[1][1][0]);
           fprintf(file, "  ST_%d -> ST_%d [label = \"#11\"];\n",
-            i, (int)a->states[i].next[1][1][1]);
+            i, (int)states[i].next[1][1][1]);
         }
       }
-      if (a->states[i].action != ACTION_RESOLUTION) {
+      if (states[i].action != ACTION_RESOLUTION) {
         fprintf(file, "  ST_%d -> ST_%d [label = \"@00\"];\n",
-          i, (int)a->states[i].next[0][0][0]);
+          i, (int)states[i].next[0][0][0]);
         fprintf(file, "  ST_%d -> ST_%d [label = \"@01\"];\n",
-          i, (int)a->states[i].next[0][0][1]);
+          i, (int)states[i].next[0][0][1]);
         if ((settings->flags & F_MISTAKE_AWARE)
           && settings->mistake_rate > 0.0)
         {
           fprintf(file, "  ST_%d -> ST_%d [label = \"#00\"];\n",
-            i, (int)a->states[i].next[1][0][0]);
+            i, (int)states[i].next[1][0][0]);
           fprintf(file, "  ST_%d -> ST_%d [label = \"#01\"];\n",
-            i, (int)a->states[i].next[1][0][1]);
+            i, (int)states[i].next[1][0][1]);
         }
       }
     }
@@ -278,23 +590,49 @@ static void state_deserialize(FILE *file, state_t *st, int state_n) {
   DESERIALIZE_USHORT_TAB(file, st, next_tab, 8, 0, state_n - 1);
 }
 
-void automaton_serialize(FILE *file, const automaton_t *a) {
+static void state_scan(scanner_t *sc, state_t *st, int state_n) {
+  scan_tag(sc, "STATE");
+  SCAN_USHORT(sc, st, action, 0, ACTION_RESOLUTION);
+  SCAN_USHORT_TAB(sc, st, next_tab, 8, 0, state_n - 1);
+}
+
+void automaton_serialize(FILE *file, const population_t *pop, int i) {
+  unsigned short state_n = pop->state_n;
   serialize_tag(file, "AUTOMATON");
-  SERIALIZE_USHORT(file, a, state_n);
-  SERIALIZE_USHORT(file, a, lifetime);
-  SERIALIZE_UINT(file, a, color);
-  for (int i = 0; i < a->state_n; ++i) {
-    state_serialize(file, &a->states[i]);
+  serialize_ushort(file, "state_n", state_n);
+  serialize_ushort(file, "lifetime", pop->lifetime[i]);
+  serialize_uint(file, "color", pop->color[i]);
+  serialize_ulong(file, "id", pop->id[i]);
+  for (int k = 0; k < pop->state_n; ++k) {
+    state_serialize(file, &pop->genome[i][k]);
   }
 }
 
-void automaton_deserialize(FILE *file, automaton_t *a) {
+void automaton_deserialize(FILE *file, population_t *pop, int i) {
+  unsigned short state_n;
   deserialize_tag(file, "AUTOMATON");
-  DESERIALIZE_USHORT(file, a, state_n, 1, MAX_STATE_N);
-  DESERIALIZE_USHORT(file, a, lifetime, 0, MAX_LIFETIME);
-  DESERIALIZE_UINT(file, a, color, 0, 0xFFFFFF);
-  a->states = malloc(sizeof(state_t) * a->state_n);
-  for (int i = 0; i < a->state_n; ++i) {
-    state_deserialize(file, &a->states[i], a->state_n);
+  deserialize_ushort(file, "state_n", &state_n, pop->state_n, pop->state_n);
+  deserialize_ushort(file, "lifetime", &pop->lifetime[i], 0, MAX_LIFETIME);
+  deserialize_uint(file, "color", &pop->color[i], 0, 0xFFFFFF);
+  unsigned long id;
+  deserialize_ulong(file, "id", &id, 0, ULONG_MAX);
+  pop->id[i] = id;
+  for (int k = 0; k < pop->state_n; ++k) {
+    state_deserialize(file, &pop->genome[i][k], pop->state_n);
+  }
+}
+
+/* The same as automaton_deserialize, from a mapped file */
+void automaton_scan(scanner_t *sc, population_t *pop, int i) {
+  unsigned short state_n;
+  scan_tag(sc, "AUTOMATON");
+  scan_ushort(sc, "state_n", &state_n, pop->state_n, pop->state_n);
+  scan_ushort(sc, "lifetime", &pop->lifetime[i], 0, MAX_LIFETIME);
+  scan_uint(sc, "color", &pop->color[i], 0, 0xFFFFFF);
+  unsigned long id = 0;
+  scan_ulong(sc, "id", &id, 0, ULONG_MAX);
+  pop->id[i] = id;
+  for (int k = 0; k < pop->state_n; ++k) {
+    state_scan(sc, &pop->genome[i][k], pop->state_n);
   }
 }
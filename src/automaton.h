@@ -3,10 +3,17 @@
 
 #include "settings.h"
 #include "mtwister.h"
+#include "transcript.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 
+struct scanner;
+
+/* actions are probabilities of cooperation, in units of 1/1024 */
+#define ACTION_RESOLUTION 1024
+
 #define A_ST_ALIVE    0
 #define A_ST_STRONG   1
 #define A_ST_SURVIVED 2
@@ -20,39 +27,99 @@ typedef struct state {
   };
 } state_t;
 
-typedef struct automaton {
-  int            score;
-  unsigned short state_n;
-  unsigned short lifetime;
-  char           status;
-  unsigned       color;
-  state_t       *states;
-} automaton_t;
+/* Population of automata, kept as a structure of arrays indexed by
+ * automata. Fields touched on every step are separated from cold ones,
+ * and genomes (tables of states) are reached through handles. Games are
+ * played on compacted copies of genomes, holding only reachable states,
+ * renumbered densely from the initial one. */
+typedef struct population {
+  int             size;
+  int             state_n;
+  int            *score;
+  char           *status;
+  unsigned short *lifetime;
+  unsigned       *color;
+  uint64_t       *id;       /* unique over the whole run */
+  state_t       **genome;
+  state_t        *states;   /* storage of all genomes */
+  state_t       **play;
+  state_t        *play_states;
+  uint64_t       *hash;     /* hashes of play tables */
+  uint64_t       *species;  /* behavioural species, see species.h */
+  uint64_t       *simhash;
+  int             mapped;   /* arrays are in memory owned by others */
+} population_t;
+
+void population_init(population_t *pop, int size, int state_n);
+size_t population_layout(int size, int state_n);
+void population_map(population_t *pop, int size, int state_n, void *base);
+void population_destroy(population_t *pop);
+void population_arrange(population_t *pop, const int *order);
+
+void population_reset(population_t *pop, const int *dirty);
+
+void automaton_init(
+  population_t     *pop,
+  int               i,
+  const settings_t *settings,
+  MTRand           *rand);
 
-void automaton_init(automaton_t *a, const settings_t *settings, MTRand *rand);
-void automaton_destroy(automaton_t *a);
+int automaton_game(
+  const population_t *pop,
+  int                 i,
+  int                 j,
+  const settings_t   *settings,
+  MTRand             *rand,
+  int                *score_j);
 
-void automaton_reset(automaton_t *a);
+int automaton_game_traced(
+  const population_t *pop,
+  int                 i,
+  int                 j,
+  const settings_t   *settings,
+  MTRand             *rand,
+  int                *score_j,
+  transcript_turn_t  *trace);
 
 void automaton_play(
-  automaton_t      *a1,
-  automaton_t      *a2,
+  population_t     *pop,
+  int               i,
+  int               j,
   const settings_t *settings,
   MTRand           *rand);
 
+int automaton_play_det(
+  const population_t *pop,
+  int                 i,
+  int                 j,
+  const settings_t   *settings);
+
 void automaton_cross(
-  automaton_t       *a,
-  const automaton_t *p1,
-  const automaton_t *p2,
-  const settings_t  *settings,
-  MTRand            *rand);
+  population_t     *pop,
+  int               i,
+  int               p1,
+  int               p2,
+  const settings_t *settings,
+  MTRand           *rand);
 
 void automaton_print(
-  FILE              *file,
-  const settings_t  *settings,
-  const automaton_t *a);
+  FILE               *file,
+  const settings_t   *settings,
+  const population_t *pop,
+  int                 i);
+
+void automaton_canonicalise(
+  state_t          *states,
+  int               n,
+  const settings_t *settings);
+
+void automaton_compact(
+  population_t     *pop,
+  int               i,
+  const settings_t *settings);
 
-void automaton_serialize(FILE *file, const automaton_t *a);
-void automaton_deserialize(FILE *file, automaton_t *a);
+void automaton_serialize(FILE *file, const population_t *pop, int i);
+void automaton_deserialize(FILE *file, population_t *pop, int i);
+void automaton_scan(struct scanner *sc, population_t *pop, int i);
 
 #endif
@@ -0,0 +1,298 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "control.h"
+
+#include <errno.h>
+#include <error.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LINE_SIZE 256
+#define REPLY_SIZE 1024
+
+static const char *phase_names[PHASE_N] =
+  { "reset", "play", "kill", "spawn", "report" };
+
+double control_clock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static int set_rate(control_t *ctl, const char *name, long value) {
+  if (value < 1 || value > MAX_REPORT_RATE) {
+    return CHECK_FAIL;
+  }
+  if (strcmp(name, "image_rate") == 0) {
+    ctl->new_image_rate = value;
+  } else if (strcmp(name, "example_rate") == 0) {
+    ctl->new_example_rate = value;
+  } else if (strcmp(name, "stat_report_rate") == 0) {
+    ctl->new_stat_report_rate = value;
+  } else {
+    return CHECK_FAIL;
+  }
+  return CHECK_OK;
+}
+
+/* Executes a command of a client, with the lock held */
+static void execute(control_t *ctl, const char *line, char *reply) {
+  char cmd[32];
+  char name[32];
+  long value;
+  int  args = sscanf(line, "%31s %31s %ld", cmd, name, &value);
+  if (args < 1) {
+    reply[0] = 0;
+  } else if (strcmp(cmd, "step") == 0) {
+    sprintf(reply, "ok %lu\n", ctl->step);
+  } else if (strcmp(cmd, "stats") == 0) {
+    sprintf(reply, "ok step=%lu avg_score=%f births=%lu steady=%d "
+      "paused=%d image_rate=%d example_rate=%d stat_report_rate=%d\n",
+      ctl->step, ctl->avg_score, ctl->births, ctl->steady, ctl->paused,
+      ctl->image_rate, ctl->example_rate, ctl->stat_report_rate);
+  } else if (strcmp(cmd, "timings") == 0) {
+    int len = sprintf(reply, "ok");
+    for (int p = 0; p < PHASE_N; ++p) {
+      len += sprintf(reply + len, " %s=%.6f/%.3f", phase_names[p],
+        ctl->phase_time[p], ctl->phase_total[p]);
+    }
+    sprintf(reply + len, "\n");
+  } else if (strcmp(cmd, "checkpoint") == 0) {
+    ctl->checkpoint = 1;
+    sprintf(reply, "ok\n");
+  } else if (strcmp(cmd, "image") == 0) {
+    if (ctl->can_image) {
+      ctl->image = 1;
+      sprintf(reply, "ok\n");
+    } else {
+      sprintf(reply, "error no --image-name nor --tiles given\n");
+    }
+  } else if (strcmp(cmd, "set") == 0) {
+    if (args == 3 && set_rate(ctl, name, value) == CHECK_OK) {
+      sprintf(reply, "ok\n");
+    } else {
+      sprintf(reply, "error usage: set image_rate|example_rate|"
+        "stat_report_rate N\n");
+    }
+  } else if (strcmp(cmd, "pause") == 0) {
+    ctl->paused = 1;
+    sprintf(reply, "ok\n");
+  } else if (strcmp(cmd, "resume") == 0) {
+    ctl->paused = 0;
+    sprintf(reply, "ok\n");
+  } else if (strcmp(cmd, "help") == 0) {
+    sprintf(reply, "ok commands: step, stats, timings (last/total seconds), "
+      "checkpoint, image, set RATE N, pause, resume\n");
+  } else {
+    sprintf(reply, "error unknown command `%s'\n", cmd);
+  }
+  pthread_cond_broadcast(&ctl->wake);
+}
+
+static void *control_serve(void *arg) {
+  control_t *ctl = arg;
+  char line[LINE_SIZE];
+  char reply[REPLY_SIZE];
+  while (1) {
+    int client = accept(ctl->fd, NULL, NULL);
+    if (client < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    pthread_mutex_lock(&ctl->lock);
+    ctl->client = client;
+    pthread_mutex_unlock(&ctl->lock);
+    FILE *in = fdopen(client, "r");
+    while (fgets(line, sizeof(line), in) != NULL) {
+      pthread_mutex_lock(&ctl->lock);
+      execute(ctl, line, reply);
+      pthread_mutex_unlock(&ctl->lock);
+      send(client, reply, strlen(reply), MSG_NOSIGNAL);
+    }
+    pthread_mutex_lock(&ctl->lock);
+    ctl->client = -1;
+    pthread_mutex_unlock(&ctl->lock);
+    fclose(in);
+  }
+  return NULL;
+}
+
+/* Waits for the background checkpoint, if there is one */
+static void wait_child(control_t *ctl) {
+  if (ctl->child > 0) {
+    waitpid(ctl->child, NULL, 0);
+    ctl->child = 0;
+  }
+}
+
+/* Collects the background checkpoint if it has finished, without waiting
+ * for it */
+static void reap_child(control_t *ctl) {
+  if (ctl->child > 0 && waitpid(ctl->child, NULL, WNOHANG) != 0) {
+    ctl->child = 0;
+  }
+}
+
+void control_open(
+  control_t *ctl, const char *path, const world_t *world,
+  volatile sig_atomic_t *interrupt)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    error(EXIT_FAILURE, 0, "control socket path `%s' is too long", path);
+  }
+  strcpy(addr.sun_path, path);
+
+  ctl->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (ctl->fd < 0) {
+    error(EXIT_FAILURE, errno, "cannot create control socket");
+  }
+  unlink(path);
+  if (bind(ctl->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+    || listen(ctl->fd, 4) != 0)
+  {
+    error(EXIT_FAILURE, errno, "cannot bind control socket `%s'", path);
+  }
+
+  ctl->path      = path;
+  ctl->interrupt = interrupt;
+  ctl->can_image = world->settings.image_name != NULL || world->tiles != NULL;
+  ctl->client    = -1;
+  ctl->child     = 0;
+  ctl->step      = 0;
+  ctl->births    = 0;
+  ctl->avg_score = 0.0;
+  ctl->steady    = 0;
+  for (int p = 0; p < PHASE_N; ++p) {
+    ctl->phase_time[p]  = 0.0;
+    ctl->phase_total[p] = 0.0;
+  }
+  ctl->paused               = 0;
+  ctl->checkpoint           = 0;
+  ctl->image                = 0;
+  ctl->new_image_rate       = 0;
+  ctl->new_example_rate     = 0;
+  ctl->new_stat_report_rate = 0;
+  pthread_mutex_init(&ctl->lock, NULL);
+  pthread_cond_init(&ctl->wake, NULL);
+  int err = pthread_create(&ctl->thread, NULL, control_serve, ctl);
+  if (err != 0) {
+    error(EXIT_FAILURE, err, "cannot start the control thread");
+  }
+}
+
+void control_close(control_t *ctl) {
+  shutdown(ctl->fd, SHUT_RDWR);
+  pthread_mutex_lock(&ctl->lock);
+  if (ctl->client >= 0) {
+    shutdown(ctl->client, SHUT_RDWR);
+  }
+  pthread_mutex_unlock(&ctl->lock);
+  pthread_join(ctl->thread, NULL);
+  close(ctl->fd);
+  unlink(ctl->path);
+  wait_child(ctl);
+  pthread_mutex_destroy(&ctl->lock);
+  pthread_cond_destroy(&ctl->wake);
+}
+
+/* The world is written by a forked copy of the process, so the
+ * simulation goes on while it is saved. A persistent world is shared with
+ * the copy, so it is checkpointed here. Checkpoints are made at the end of
+ * a step, so they hold the world as the next step will find it. */
+static void start_checkpoint(control_t *ctl, world_t *world) {
+  wait_child(ctl);
+  world->step++;
+  if (world->persist != NULL) {
+    world_serialize(world);
+  } else {
+    /* only this thread goes on in the child: the control and lineage
+     * threads and OpenMP workers are gone, and locks they held stay
+     * taken. world_serialize must thus use neither OpenMP nor locks
+     * other than those of its own file. */
+    pid_t pid = fork();
+    if (pid == 0) {
+      world_serialize(world);
+      _exit(0);
+    } else if (pid < 0) {
+      error(0, errno, "cannot fork for checkpoint, saving in foreground");
+      world_serialize(world);
+    } else {
+      ctl->child = pid;
+    }
+  }
+  world->step--;
+}
+
+/* Publishes the state of the world and carries out requested actions.
+ * Called by the simulation at the end of each step, before the step
+ * counter advances; blocks while it is paused. */
+void control_sync(control_t *ctl, world_t *world, const double *phase_time)
+{
+  reap_child(ctl);
+  pthread_mutex_lock(&ctl->lock);
+  ctl->step             = world->step;
+  ctl->births           = world->births;
+  ctl->avg_score        = world_avg_score(world);
+  ctl->steady           = world->steady;
+  ctl->image_rate       = world->settings.image_rate;
+  ctl->example_rate     = world->settings.example_rate;
+  ctl->stat_report_rate = world->settings.stat_report_rate;
+  for (int p = 0; p < PHASE_N; ++p) {
+    ctl->phase_time[p]   = phase_time[p];
+    ctl->phase_total[p] += phase_time[p];
+  }
+  while (1) {
+    if (ctl->new_image_rate) {
+      world->settings.image_rate = ctl->image_rate = ctl->new_image_rate;
+      ctl->new_image_rate = 0;
+    }
+    if (ctl->new_example_rate) {
+      world->settings.example_rate = ctl->example_rate =
+        ctl->new_example_rate;
+      ctl->new_example_rate = 0;
+    }
+    if (ctl->new_stat_report_rate) {
+      world->settings.stat_report_rate = ctl->stat_report_rate =
+        ctl->new_stat_report_rate;
+      ctl->new_stat_report_rate = 0;
+    }
+    if (ctl->checkpoint || ctl->image) {
+      int checkpoint = ctl->checkpoint;
+      int image      = ctl->image;
+      ctl->checkpoint = ctl->image = 0;
+      /* the world is written without the lock, so that clients get
+       * answers meanwhile; only this thread touches it */
+      pthread_mutex_unlock(&ctl->lock);
+      if (checkpoint) {
+        start_checkpoint(ctl, world);
+      }
+      if (image) {
+        world_report_image(world);
+      }
+      pthread_mutex_lock(&ctl->lock);
+      continue;
+    }
+    if (!ctl->paused || *ctl->interrupt) {
+      break;
+    }
+    /* wake up now and then, so that the process can be interrupted */
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec += 100000000;
+    if (until.tv_nsec >= 1000000000) {
+      until.tv_sec++;
+      until.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&ctl->wake, &ctl->lock, &until);
+  }
+  pthread_mutex_unlock(&ctl->lock);
+}
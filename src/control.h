@@ -0,0 +1,60 @@
+#ifndef __CONTROL_H
+#define __CONTROL_H
+
+#include "world.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/types.h>
+
+#define PHASE_RESET  0
+#define PHASE_PLAY   1
+#define PHASE_KILL   2
+#define PHASE_SPAWN  3
+#define PHASE_REPORT 4
+#define PHASE_N      5
+
+/* Control socket, served by its own thread. Clients send one command per
+ * line and get one line back. Queries are answered from the state
+ * published at the end of the last step, and actions are carried out by
+ * the simulation at the end of the next one. */
+typedef struct control {
+  const char     *path;
+  int             fd;
+  pthread_t       thread;
+  pthread_mutex_t lock;
+  pthread_cond_t  wake;
+  int             client;
+  int             can_image;  /* images or tiles are written */
+  pid_t           child;  /* background checkpoint, or 0 */
+  volatile sig_atomic_t *interrupt;
+
+  /* state published at the end of each step */
+  unsigned long   step;
+  unsigned long   births;
+  double          avg_score;
+  int             steady;
+  int             image_rate;
+  int             example_rate;
+  int             stat_report_rate;
+  double          phase_time[PHASE_N];
+  double          phase_total[PHASE_N];
+
+  /* requests of clients */
+  int             paused;
+  int             checkpoint;
+  int             image;
+  int             new_image_rate;
+  int             new_example_rate;
+  int             new_stat_report_rate;
+} control_t;
+
+void control_open(
+  control_t *ctl, const char *path, const world_t *world,
+  volatile sig_atomic_t *interrupt);
+void control_close(control_t *ctl);
+void control_sync(control_t *ctl, world_t *world, const double *phase_time);
+
+double control_clock(void);
+
+#endif
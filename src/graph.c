@@ -0,0 +1,415 @@
+#include "graph.h"
+
+#include "mtwister.h"
+
+#include <errno.h>
+#include <error.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* ========================================================================= */
+/* Edge lists */
+
+typedef struct edge_list {
+  size_t    size;
+  size_t    capacity;
+  uint64_t *edges;
+} edge_list_t;
+
+static void add_edge(edge_list_t *el, int u, int v) {
+  if (u == v) {
+    return;
+  }
+  if (el->size + 2 > el->capacity) {
+    el->capacity = 2*el->capacity + 64;
+    el->edges    = realloc(el->edges, sizeof(uint64_t) * el->capacity);
+  }
+  /* graphs are undirected, so we store both directions */
+  el->edges[el->size++] = ((uint64_t)u << 32) | (uint32_t)v;
+  el->edges[el->size++] = ((uint64_t)v << 32) | (uint32_t)u;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+/* Builds the graph from the edge list, dropping repeated edges */
+static void graph_from_edges(graph_t *g, int vertex_n, edge_list_t *el) {
+  if (el->size > INT_MAX) {
+    error(EXIT_FAILURE, 0, "the graph has too many edges (%zu, at most %d)",
+      el->size, INT_MAX);
+  }
+  qsort(el->edges, el->size, sizeof(uint64_t), cmp_u64);
+  g->vertex_n  = vertex_n;
+  g->radius    = 0;
+  g->with_self = 0;
+  g->offset   = calloc(vertex_n + 1, sizeof(int));
+  g->adj      = malloc(sizeof(int) * (el->size + 1));
+  size_t n = 0;
+  for (size_t e = 0; e < el->size; ++e) {
+    if (e > 0 && el->edges[e] == el->edges[e-1]) {
+      continue;
+    }
+    g->offset[(el->edges[e] >> 32) + 1]++;
+    g->adj[n++] = el->edges[e] & 0xFFFFFFFF;
+  }
+  for (int v = 0; v < vertex_n; ++v) {
+    g->offset[v+1] += g->offset[v];
+  }
+  free(el->edges);
+}
+
+/* ========================================================================= */
+/* Generators */
+
+static int torus_vertex(const settings_t *settings, int x, int y) {
+  int size_x = settings->board_size_x;
+  int size_y = settings->board_size_y;
+  x = (x % size_x + size_x) % size_x;
+  y = (y % size_y + size_y) % size_y;
+  return y * size_x + x;
+}
+
+/* Moore neighbourhood on a torus */
+static void gen_torus(edge_list_t *el, const settings_t *settings) {
+  for (int y = 0; y < settings->board_size_y; ++y) {
+    for (int x = 0; x < settings->board_size_x; ++x) {
+      int v = torus_vertex(settings, x, y);
+      add_edge(el, v, torus_vertex(settings, x + 1, y));
+      add_edge(el, v, torus_vertex(settings, x - 1, y + 1));
+      add_edge(el, v, torus_vertex(settings, x,     y + 1));
+      add_edge(el, v, torus_vertex(settings, x + 1, y + 1));
+    }
+  }
+}
+
+static void gen_von_neumann(edge_list_t *el, const settings_t *settings) {
+  for (int y = 0; y < settings->board_size_y; ++y) {
+    for (int x = 0; x < settings->board_size_x; ++x) {
+      int v = torus_vertex(settings, x, y);
+      add_edge(el, v, torus_vertex(settings, x + 1, y));
+      add_edge(el, v, torus_vertex(settings, x, y + 1));
+    }
+  }
+}
+
+/* Hexagonal lattice, where odd rows are shifted right by half a cell */
+static void gen_hex(edge_list_t *el, const settings_t *settings) {
+  for (int y = 0; y < settings->board_size_y; ++y) {
+    for (int x = 0; x < settings->board_size_x; ++x) {
+      int v = torus_vertex(settings, x, y);
+      int s = y % 2;
+      add_edge(el, v, torus_vertex(settings, x + 1, y));
+      add_edge(el, v, torus_vertex(settings, x - 1 + s, y + 1));
+      add_edge(el, v, torus_vertex(settings, x + s, y + 1));
+    }
+  }
+}
+
+/* Watts-Strogatz: each edge of the torus is rewired to a random vertex
+ * with probability rewire_rate */
+static void gen_small_world(
+  edge_list_t *el, const settings_t *settings, MTRand *rand)
+{
+  int vertex_n = settings->board_size_x * settings->board_size_y;
+  edge_list_t torus = { 0, 0, NULL };
+  gen_torus(&torus, settings);
+  qsort(torus.edges, torus.size, sizeof(uint64_t), cmp_u64);
+  unsigned long next = genRandGap(rand, settings->rewire_rate);
+  for (size_t e = 0; e < torus.size; ++e) {
+    int u = torus.edges[e] >> 32;
+    int v = torus.edges[e] & 0xFFFFFFFF;
+    if (u > v || (e > 0 && torus.edges[e] == torus.edges[e-1])) {
+      continue;
+    }
+    if (next == 0) {
+      v = genRandBounded(rand, vertex_n);
+      next = genRandGap(rand, settings->rewire_rate);
+    } else {
+      next--;
+    }
+    add_edge(el, u, v);
+  }
+  free(torus.edges);
+}
+
+/* Barabasi-Albert: each vertex is attached to attach_n earlier vertices,
+ * chosen with probability proportional to their degree */
+static void gen_scale_free(
+  edge_list_t *el, const settings_t *settings, MTRand *rand)
+{
+  int vertex_n = settings->board_size_x * settings->board_size_y;
+  int m = settings->attach_n;
+  if (vertex_n <= m) {
+    error(EXIT_FAILURE, 0,
+      "scale-free graph needs more than %d vertices", m);
+  }
+  for (int u = 0; u <= m; ++u) {
+    for (int v = u + 1; v <= m; ++v) {
+      add_edge(el, u, v);
+    }
+  }
+  int *targets = malloc(sizeof(int) * m);
+  for (int v = m + 1; v < vertex_n; ++v) {
+    size_t ends = el->size;
+    for (int t = 0; t < m; ++t) {
+      int u, dup;
+      do {
+        /* a random end of a random edge */
+        u = el->edges[genRandBounded(rand, ends)] >> 32;
+        dup = 0;
+        for (int s = 0; s < t; ++s) {
+          dup |= (targets[s] == u);
+        }
+      } while (dup);
+      targets[t] = u;
+    }
+    for (int t = 0; t < m; ++t) {
+      add_edge(el, v, targets[t]);
+    }
+  }
+  free(targets);
+}
+
+/* Reads an edge list: one pair of vertex numbers per line. Empty lines and
+ * lines starting with # are skipped. */
+static void load_edges(edge_list_t *el, const settings_t *settings) {
+  int vertex_n = settings->board_size_x * settings->board_size_y;
+  FILE *file = fopen(settings->graph_file, "r");
+  if (file == NULL) {
+    error(EXIT_FAILURE, errno, "cannot open graph file `%s'",
+      settings->graph_file);
+  }
+  char line[256];
+  int  line_no = 0;
+  while (fgets(line, sizeof(line), file)) {
+    line_no++;
+    char *p = line + strspn(line, " \t");
+    if (*p == '#' || *p == '\n' || *p == 0) {
+      continue;
+    }
+    int u, v;
+    if (sscanf(p, "%d %d", &u, &v) != 2
+      || u < 0 || u >= vertex_n || v < 0 || v >= vertex_n)
+    {
+      error(EXIT_FAILURE, 0, "invalid graph file `%s' (at line %d)",
+        settings->graph_file, line_no);
+    }
+    add_edge(el, u, v);
+  }
+  fclose(file);
+}
+
+/* Generates the graph of direct neighbours for the topology of settings.
+ * Vertices are cells of the board, in raster order. */
+void graph_generate(graph_t *g, const settings_t *settings) {
+  int vertex_n = settings->board_size_x * settings->board_size_y;
+  edge_list_t el = { 0, 0, NULL };
+  /* the graph has its own generator, independent of the simulation */
+  MTRand rand = seedRand(settings->seed ^ 0x67726170ul);
+  switch (settings->topology) {
+  case TOPOLOGY_TORUS:
+    gen_torus(&el, settings);
+    break;
+  case TOPOLOGY_VON_NEUMANN:
+    gen_von_neumann(&el, settings);
+    break;
+  case TOPOLOGY_HEX:
+    gen_hex(&el, settings);
+    break;
+  case TOPOLOGY_SMALL_WORLD:
+    gen_small_world(&el, settings, &rand);
+    break;
+  case TOPOLOGY_SCALE_FREE:
+    gen_scale_free(&el, settings, &rand);
+    break;
+  case TOPOLOGY_FILE:
+    load_edges(&el, settings);
+    break;
+  }
+  graph_from_edges(g, vertex_n, &el);
+}
+
+/* ========================================================================= */
+
+/* Breadth-first search from v up to the given radius. Visited vertices
+ * are stored in queue, in the order of distance, and their number is
+ * returned. Vertices are visited in this walk, if their stamp is gen. */
+static int bfs(
+  const graph_t *g, int v, int radius, int with_self,
+  unsigned *stamp, unsigned gen, int *queue)
+{
+  int head = 0;
+  int tail = 0;
+  int level_end;
+  queue[tail++] = v;
+  stamp[v] = gen;
+  for (int d = 0; d < radius; ++d) {
+    level_end = tail;
+    for (; head < level_end; ++head) {
+      int u = queue[head];
+      for (int e = g->offset[u]; e < g->offset[u+1]; ++e) {
+        if (stamp[g->adj[e]] != gen) {
+          stamp[g->adj[e]] = gen;
+          queue[tail++] = g->adj[e];
+        }
+      }
+    }
+  }
+  if (!with_self) {
+    memmove(queue, queue + 1, sizeof(int) * (tail - 1));
+    tail--;
+  }
+  return tail;
+}
+
+/* Buffers are allocated at the first walk, so walks cost nothing when
+ * balls are stored */
+void graph_walk_init(graph_walk_t *w) {
+  w->stamp = NULL;
+  w->gen   = 0;
+  w->queue = NULL;
+}
+
+void graph_walk_destroy(graph_walk_t *w) {
+  free(w->stamp);
+  free(w->queue);
+}
+
+/* Finds neighbours of v in the ball, in the order of distance, and
+ * returns their number. They are stored in the ball, or found by a walk
+ * into buffers of w. */
+int graph_neighbours(
+  const graph_t *ball, int v, graph_walk_t *w, const int **nb)
+{
+  if (ball->radius == 0) {
+    *nb = &ball->adj[ball->offset[v]];
+    return ball->offset[v+1] - ball->offset[v];
+  }
+  if (w->stamp == NULL) {
+    w->stamp = calloc(ball->vertex_n, sizeof(unsigned));
+    w->queue = malloc(sizeof(int) * ball->vertex_n);
+  }
+  if (++w->gen == 0) {
+    memset(w->stamp, 0, sizeof(unsigned) * ball->vertex_n);
+    w->gen = 1;
+  }
+  *nb = w->queue;
+  return bfs(ball, v, ball->radius, ball->with_self, w->stamp, w->gen,
+    w->queue);
+}
+
+/* Builds the graph connecting each vertex with all vertices at distance
+ * at most radius, ordered by distance. If it would be too large, e.g., for
+ * a wide area on a scale-free graph, where balls cover most of the graph,
+ * it is a copy of g to be walked instead. */
+void graph_ball(graph_t *ball, const graph_t *g, int radius, int with_self) {
+  int    n     = g->vertex_n;
+  size_t total = 0;
+  ball->vertex_n  = n;
+  ball->offset    = malloc(sizeof(int) * (n + 1));
+  ball->offset[0] = 0;
+  ball->radius    = 0;
+  ball->with_self = with_self;
+  #pragma omp parallel
+  {
+    graph_walk_t w = { calloc(n, sizeof(unsigned)), 0,
+                       malloc(sizeof(int) * n) };
+    #pragma omp for reduction(+:total)
+    for (int v = 0; v < n; ++v) {
+      ball->offset[v+1] = bfs(g, v, radius, with_self, w.stamp, v + 1,
+        w.queue);
+      total += ball->offset[v+1];
+    }
+    graph_walk_destroy(&w);
+  }
+  if (total > GRAPH_BALL_MAX) {
+    memcpy(ball->offset, g->offset, sizeof(int) * (n + 1));
+    ball->adj = malloc(sizeof(int) * (g->offset[n] + 1));
+    memcpy(ball->adj, g->adj, sizeof(int) * g->offset[n]);
+    ball->radius = radius;
+    return;
+  }
+  for (int v = 0; v < n; ++v) {
+    ball->offset[v+1] += ball->offset[v];
+  }
+  ball->adj = malloc(sizeof(int) * (total + 1));
+  #pragma omp parallel
+  {
+    graph_walk_t w = { calloc(n, sizeof(unsigned)), 0,
+                       malloc(sizeof(int) * n) };
+    #pragma omp for
+    for (int v = 0; v < n; ++v) {
+      bfs(g, v, radius, with_self, w.stamp, v + 1, w.queue);
+      memcpy(&ball->adj[ball->offset[v]], w.queue,
+        sizeof(int) * (ball->offset[v+1] - ball->offset[v]));
+    }
+    graph_walk_destroy(&w);
+  }
+}
+
+/* Sorts vertices by degree, and then by number, through keys holding
+ * both */
+static void sort_by_degree(const graph_t *g, int *v, int n, uint64_t *keys) {
+  for (int i = 0; i < n; ++i) {
+    uint64_t degree = g->offset[v[i]+1] - g->offset[v[i]];
+    keys[i] = (degree << 32) | (uint32_t)v[i];
+  }
+  qsort(keys, n, sizeof(uint64_t), cmp_u64);
+  for (int i = 0; i < n; ++i) {
+    v[i] = keys[i] & 0xFFFFFFFF;
+  }
+}
+
+/* Returns vertices in the reverse Cuthill-McKee order, which keeps
+ * neighbours close to each other */
+int *graph_order(const graph_t *g) {
+  int n = g->vertex_n;
+  int *order   = malloc(sizeof(int) * n);
+  int *visited = calloc(n, sizeof(int));
+  int *start   = malloc(sizeof(int) * n);
+  int  tail    = 0;
+  uint64_t *keys = malloc(sizeof(uint64_t) * n);
+  for (int v = 0; v < n; ++v) {
+    start[v] = v;
+  }
+  sort_by_degree(g, start, n, keys);
+  for (int s = 0; s < n; ++s) {
+    if (visited[start[s]]) {
+      continue;
+    }
+    int head = tail;
+    order[tail++] = start[s];
+    visited[start[s]] = 1;
+    for (; head < tail; ++head) {
+      int u = order[head];
+      int first = tail;
+      for (int e = g->offset[u]; e < g->offset[u+1]; ++e) {
+        if (!visited[g->adj[e]]) {
+          visited[g->adj[e]] = 1;
+          order[tail++] = g->adj[e];
+        }
+      }
+      sort_by_degree(g, &order[first], tail - first, keys);
+    }
+  }
+  for (int i = 0; i < n / 2; ++i) {
+    int t = order[i];
+    order[i] = order[n - 1 - i];
+    order[n - 1 - i] = t;
+  }
+  free(visited);
+  free(start);
+  free(keys);
+  return order;
+}
+
+void graph_destroy(graph_t *g) {
+  free(g->offset);
+  free(g->adj);
+}
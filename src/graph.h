@@ -0,0 +1,40 @@
+#ifndef __GRAPH_H
+#define __GRAPH_H
+
+#include "settings.h"
+
+#include <stddef.h>
+
+/* Largest number of entries of a ball that is stored */
+#define GRAPH_BALL_MAX ((size_t)1 << 26)
+
+/* Graph in compressed sparse row form: neighbours of vertex v are
+ * adj[offset[v]], ..., adj[offset[v+1]-1]. A ball with more than
+ * GRAPH_BALL_MAX entries is not stored: it keeps the graph it is a ball
+ * of, and radius > 0, and neighbourhoods are found by walking it. */
+typedef struct graph {
+  int  vertex_n;
+  int *offset;
+  int *adj;
+  int  radius;
+  int  with_self;
+} graph_t;
+
+/* Buffers of a walk, one for each thread */
+typedef struct graph_walk {
+  unsigned *stamp;
+  unsigned  gen;
+  int      *queue;
+} graph_walk_t;
+
+void graph_generate(graph_t *g, const settings_t *settings);
+void graph_ball(graph_t *ball, const graph_t *g, int radius, int with_self);
+int *graph_order(const graph_t *g);
+void graph_destroy(graph_t *g);
+
+void graph_walk_init(graph_walk_t *w);
+void graph_walk_destroy(graph_walk_t *w);
+int graph_neighbours(
+  const graph_t *ball, int v, graph_walk_t *w, const int **nb);
+
+#endif
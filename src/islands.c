@@ -0,0 +1,397 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "islands.h"
+
+#include "mtwister.h"
+#include "world.h"
+
+#include <errno.h>
+#include <error.h>
+#include <omp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ISLAND_NAME_N 8
+
+struct archipelago;
+
+typedef struct island {
+  world_t             world;
+  struct archipelago *arch;
+  pthread_t           thread;
+  int                 done;         /* the world has stopped */
+  unsigned long       migrated_at;  /* step of the last migration */
+  unsigned long       saved_at;     /* step of the last checkpoint */
+  char               *names[ISLAND_NAME_N];
+
+  /* emigrants selected at the current migration point */
+  int                 out_n;
+  int                *out_cell;
+  state_t            *out_genome;
+  unsigned           *out_color;
+  unsigned short     *out_lifetime;
+  uint64_t           *out_id;
+  int                *in_cell;
+} island_t;
+
+typedef struct archipelago {
+  islands_spec_t         spec;
+  island_t              *island;
+  unsigned long          seed;
+  int                    thread_n;  /* OpenMP threads of each island */
+  int                    quiet;
+  volatile sig_atomic_t *interrupt;
+  pthread_barrier_t      barrier;
+  int                    stop;
+  char                  *send;      /* send[src * n + dst] */
+} archipelago_t;
+
+/* Derives the name of a file of island k from the name given for the whole
+ * run: files get a suffix, and prefixes of names get the number. */
+static char *island_name(
+  island_t *isl, int slot, const char *name, const char *fmt, int k)
+{
+  if (name == NULL) {
+    return NULL;
+  }
+  isl->names[slot] = malloc(strlen(name) + 16);
+  sprintf(isl->names[slot], fmt, name, k);
+  return isl->names[slot];
+}
+
+static void island_settings(
+  island_t *isl, settings_t *s, const settings_t *base, int k)
+{
+  *s = *base;
+  s->seed  = base->seed + k;
+  s->flags |= F_QUIET;
+  s->stat_file       = island_name(isl, 0, base->stat_file, "%s.%d", k);
+  s->persist_name    = island_name(isl, 1, base->persist_name, "%s.%d", k);
+  s->transcript_name = island_name(isl, 2, base->transcript_name, "%s.%d",
+                                   k);
+  s->lineage_name    = island_name(isl, 3, base->lineage_name, "%s.%d", k);
+  s->tiles_name      = island_name(isl, 4, base->tiles_name, "%s.%d", k);
+  s->live_name       = island_name(isl, 5, base->live_name, "%s.%d", k);
+  s->image_name      = island_name(isl, 6, base->image_name, "%s%d_", k);
+  s->example_name    = island_name(isl, 7, base->example_name, "%s%d_", k);
+}
+
+/* Orders automata by score (increasing, or decreasing when sign is -1),
+ * and then by cell */
+static int cell_before(const int *score, int sign, int i, int j) {
+  if (score[i] != score[j]) {
+    return sign * score[i] > sign * score[j];
+  }
+  return i < j;
+}
+
+static void sift_down(const int *score, int sign, int *heap, int n, int r) {
+  for (;;) {
+    int c = 2 * r + 1;
+    if (c >= n) {
+      return;
+    }
+    if (c + 1 < n && cell_before(score, sign, heap[c], heap[c + 1])) {
+      c++;
+    }
+    if (!cell_before(score, sign, heap[r], heap[c])) {
+      return;
+    }
+    int t = heap[r];
+    heap[r] = heap[c];
+    heap[c] = t;
+    r = c;
+  }
+}
+
+static void heapify(const int *score, int sign, int *heap, int n) {
+  for (int r = n / 2 - 1; r >= 0; --r) {
+    sift_down(score, sign, heap, n, r);
+  }
+}
+
+/* Picks at most m automata with the highest scores (or the lowest ones,
+ * when sign is -1), best first. Newborns are skipped, since their scores
+ * are those of their predecessors. Selection keeps the m best ones seen so
+ * far in a heap, which is cheap for a few migrants on a large board. */
+static int select_cells(const world_t *world, int m, int sign, int *out) {
+  const int *score = world->pop.score;
+  int n = 0;
+  for (int i = 0; i < world->pop.size && m > 0; ++i) {
+    if (world->pop.status[i] == A_ST_DEAD) {
+      continue;
+    }
+    if (n < m) {
+      out[n++] = i;
+      if (n == m) {
+        heapify(score, sign, out, n);
+      }
+    } else if (cell_before(score, sign, i, out[0])) {
+      out[0] = i;
+      sift_down(score, sign, out, n, 0);
+    }
+  }
+  if (n < m) {
+    heapify(score, sign, out, n);
+  }
+  for (int k = n - 1; k > 0; --k) {
+    int t = out[0];
+    out[0] = out[k];
+    out[k] = t;
+    sift_down(score, sign, out, k, 0);
+  }
+  return n;
+}
+
+/* Copies the best automata, so that they can be sent while the island
+ * receives others */
+static void island_emigrate(island_t *isl) {
+  const population_t *pop = &isl->world.pop;
+  isl->out_n = 0;
+  if (isl->done) {
+    return;
+  }
+  isl->out_n = select_cells(&isl->world, isl->arch->spec.migrant_n, 1,
+    isl->out_cell);
+  for (int m = 0; m < isl->out_n; ++m) {
+    int i = isl->out_cell[m];
+    memcpy(isl->out_genome + (size_t)m * pop->state_n, pop->genome[i],
+      sizeof(state_t) * pop->state_n);
+    isl->out_color[m]    = pop->color[i];
+    isl->out_lifetime[m] = pop->lifetime[i];
+    isl->out_id[m]       = pop->id[i];
+  }
+}
+
+/* Replaces the worst automata by immigrants, in the order of islands they
+ * come from */
+static void island_immigrate(island_t *isl, int k) {
+  archipelago_t *arch = isl->arch;
+  int n = arch->spec.n;
+  int in_n = 0;
+  isl->migrated_at = isl->world.step;
+  for (int src = 0; src < n; ++src) {
+    in_n += arch->send[src * n + k] * arch->island[src].out_n;
+  }
+  if (in_n == 0) {
+    return;
+  }
+  in_n = select_cells(&isl->world, in_n, -1, isl->in_cell);
+  int c = 0;
+  for (int src = 0; src < n && c < in_n; ++src) {
+    const island_t *from = &arch->island[src];
+    if (!arch->send[src * n + k]) {
+      continue;
+    }
+    for (int m = 0; m < from->out_n && c < in_n; ++m) {
+      world_immigrate(&isl->world, isl->in_cell[c++],
+        from->out_genome + (size_t)m * isl->world.pop.state_n,
+        from->out_color[m], from->out_lifetime[m], from->out_id[m]);
+    }
+  }
+}
+
+/* Decides who sends migrants to whom at this migration point. Random
+ * destinations depend only on the seed and the step, so that they are
+ * the same after restarting. */
+static void plan_migration(archipelago_t *arch) {
+  int n = arch->spec.n;
+  memset(arch->send, 0, (size_t)n * n);
+  for (int src = 0; src < n; ++src) {
+    const island_t *isl = &arch->island[src];
+    if (isl->done || n == 1) {
+      continue;
+    }
+    switch (arch->spec.topology) {
+    case MIGRATION_RING:
+      arch->send[src * n + (src + 1) % n] = 1;
+      break;
+    case MIGRATION_FULL:
+      for (int dst = 0; dst < n; ++dst) {
+        arch->send[src * n + dst] = (dst != src);
+      }
+      break;
+    case MIGRATION_RANDOM: {
+      uint64_t r = mix64(arch->seed ^ mix64(isl->world.step * n + src));
+      arch->send[src * n + (src + 1 + r % (n - 1)) % n] = 1;
+      break;
+    }
+    }
+  }
+  for (int dst = 0; dst < n; ++dst) {
+    if (arch->island[dst].done) {
+      for (int src = 0; src < n; ++src) {
+        arch->send[src * n + dst] = 0;
+      }
+    }
+  }
+}
+
+static void print_status(const archipelago_t *arch) {
+  unsigned long step = 0;
+  double        avg  = 0.0;
+  for (int k = 0; k < arch->spec.n; ++k) {
+    const world_t *world = &arch->island[k].world;
+    if (world->step > step) {
+      step = world->step;
+    }
+    avg += world_avg_score(world);
+  }
+  printf("\r%10lu: %10f", step, avg / arch->spec.n);
+  fflush(stdout);
+}
+
+/* Islands without a persistent file are not saved, since they would all
+ * write the same world file */
+static void island_save(island_t *isl) {
+  if (isl->world.persist != NULL) {
+    world_serialize(&isl->world);
+  }
+  isl->saved_at = isl->world.step;
+}
+
+/* A migration is due at steps divisible by the rate. Checkpoints are made
+ * before it, so it is redone after restarting from them. */
+static int migration_due(const island_t *isl) {
+  unsigned long step = isl->world.step;
+  return step > 0 && step % isl->arch->spec.rate == 0
+    && step != isl->migrated_at;
+}
+
+/* Runs the world until the next migration point, or until it stops */
+static void island_steps(island_t *isl) {
+  world_t *world = &isl->world;
+  do {
+    world_reset(world);
+    world_play(world);
+    world_kill_weak(world);
+    world_spawn_new(world);
+    world_report(world);
+    if (!world_next_step(world)) {
+      isl->done = 1;
+      return;
+    }
+  } while (!migration_due(isl) && !*isl->arch->interrupt);
+}
+
+static void *island_main(void *arg) {
+  island_t      *isl  = arg;
+  archipelago_t *arch = isl->arch;
+  int            k    = isl - arch->island;
+  omp_set_num_threads(arch->thread_n);
+  for (;;) {
+    if (!isl->done && !*arch->interrupt && !migration_due(isl)) {
+      island_steps(isl);
+    }
+    /* backups are made at migration points, where all islands are at the
+     * same step, so that they are restarted together */
+    unsigned long rate = isl->world.settings.backup_rate;
+    if (migration_due(isl) && isl->world.step / rate > isl->saved_at / rate)
+    {
+      island_save(isl);
+    }
+    island_emigrate(isl);
+    if (pthread_barrier_wait(&arch->barrier)
+      == PTHREAD_BARRIER_SERIAL_THREAD)
+    {
+      int all_done = 1;
+      for (int j = 0; j < arch->spec.n; ++j) {
+        all_done = all_done && arch->island[j].done;
+      }
+      arch->stop = *arch->interrupt || all_done;
+      if (!arch->stop) {
+        plan_migration(arch);
+      }
+      if (!arch->quiet) {
+        print_status(arch);
+      }
+    }
+    pthread_barrier_wait(&arch->barrier);
+    if (arch->stop) {
+      break;
+    }
+    island_immigrate(isl, k);
+    /* emigrants must not change before all islands have taken them */
+    pthread_barrier_wait(&arch->barrier);
+  }
+  if (*arch->interrupt) {
+    island_save(isl);
+  }
+  return NULL;
+}
+
+void islands_run(
+  const settings_t *settings, const islands_spec_t *spec, int continued,
+  volatile sig_atomic_t *interrupt)
+{
+  archipelago_t arch;
+  int n = spec->n;
+  arch.spec      = *spec;
+  arch.island    = calloc(n, sizeof(island_t));
+  arch.seed      = settings->seed;
+  arch.quiet     = (settings->flags & F_QUIET) != 0;
+  arch.interrupt = interrupt;
+  arch.stop      = 0;
+  arch.send      = calloc((size_t)n * n, 1);
+  arch.thread_n  = omp_get_num_procs() / n;
+  if (arch.thread_n < 1) {
+    arch.thread_n = 1;
+  }
+
+  /* worlds are created one by one: their own loops already run on all
+   * cores, and each is checked against the first one */
+  for (int k = 0; k < n; ++k) {
+    island_t *isl = &arch.island[k];
+    isl->arch = &arch;
+    island_settings(isl, &isl->world.settings, settings, k);
+    if (continued) {
+      world_attach(&isl->world, isl->world.settings.persist_name);
+    } else {
+      world_init(&isl->world);
+      island_save(isl);
+    }
+    isl->saved_at = isl->world.step;
+    if (isl->world.settings.state_n != arch.island[0].world.settings.state_n)
+    {
+      error(EXIT_FAILURE, 0, "islands have different numbers of states");
+    }
+    int state_n = isl->world.settings.state_n;
+    isl->out_cell     = malloc(sizeof(int) * spec->migrant_n);
+    isl->out_genome   = malloc(sizeof(state_t) * state_n * spec->migrant_n);
+    isl->out_color    = malloc(sizeof(unsigned) * spec->migrant_n);
+    isl->out_lifetime = malloc(sizeof(unsigned short) * spec->migrant_n);
+    isl->out_id       = malloc(sizeof(uint64_t) * spec->migrant_n);
+    isl->in_cell      = malloc(sizeof(int) * (n * spec->migrant_n));
+  }
+
+  pthread_barrier_init(&arch.barrier, NULL, n);
+  for (int k = 0; k < n; ++k) {
+    int err = pthread_create(&arch.island[k].thread, NULL, island_main,
+      &arch.island[k]);
+    if (err != 0) {
+      error(EXIT_FAILURE, err, "cannot start island %d", k);
+    }
+  }
+  for (int k = 0; k < n; ++k) {
+    pthread_join(arch.island[k].thread, NULL);
+  }
+  pthread_barrier_destroy(&arch.barrier);
+
+  for (int k = 0; k < n; ++k) {
+    island_t *isl = &arch.island[k];
+    world_destroy(&isl->world);
+    free(isl->out_cell);
+    free(isl->out_genome);
+    free(isl->out_color);
+    free(isl->out_lifetime);
+    free(isl->out_id);
+    free(isl->in_cell);
+    for (int s = 0; s < ISLAND_NAME_N; ++s) {
+      free(isl->names[s]);
+    }
+  }
+  free(arch.island);
+  free(arch.send);
+}
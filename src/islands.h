@@ -0,0 +1,33 @@
+#ifndef __ISLANDS_H
+#define __ISLANDS_H
+
+#include "settings.h"
+
+#include <signal.h>
+
+#define MAX_ISLAND_N 256
+
+#define MIGRATION_RING   0
+#define MIGRATION_FULL   1
+#define MIGRATION_RANDOM 2
+
+#define DFLT_MIGRATION_RATE 100
+#define DFLT_MIGRANT_N      8
+
+/* Island model: n worlds evolve in parallel, each in its own thread with
+ * its share of cores, and every rate steps the best migrant_n automata of
+ * each island replace the worst ones of the islands it sends to: the next
+ * one (ring), all others (full), or one picked at random each time.
+ * Islands wait for each other only at these migration points. */
+typedef struct islands_spec {
+  int n;
+  int rate;
+  int migrant_n;
+  int topology;
+} islands_spec_t;
+
+void islands_run(
+  const settings_t *settings, const islands_spec_t *spec, int continued,
+  volatile sig_atomic_t *interrupt);
+
+#endif
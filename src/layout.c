@@ -0,0 +1,88 @@
+#include "layout.h"
+
+#include "settings.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Sort keys hold the position on the curve above the raster index of the
+ * cell, which takes CELL_BITS bits. Curves fill squares of at most twice
+ * the largest side. */
+#define CELL_BITS  24
+#define COORD_BITS 16
+
+_Static_assert((uint64_t)MAX_BOARD_SIZE * MAX_BOARD_SIZE <= 1ull << CELL_BITS,
+  "cell indices do not fit in CELL_BITS bits");
+_Static_assert(2 * MAX_BOARD_SIZE <= 1ull << COORD_BITS,
+  "coordinates do not fit in COORD_BITS bits");
+_Static_assert(CELL_BITS + 2 * COORD_BITS <= 64,
+  "sort keys do not fit in 64 bits");
+
+static uint64_t morton_key(unsigned x, unsigned y) {
+  uint64_t key = 0;
+  for (int b = 0; b < COORD_BITS; ++b) {
+    key |= (uint64_t)((x >> b) & 1) << (2*b);
+    key |= (uint64_t)((y >> b) & 1) << (2*b + 1);
+  }
+  return key;
+}
+
+/* Distance along the Hilbert curve filling the n x n square, where n is
+ * a power of two */
+static uint64_t hilbert_key(unsigned n, unsigned x, unsigned y) {
+  uint64_t key = 0;
+  for (unsigned s = n / 2; s > 0; s /= 2) {
+    unsigned rx = (x & s) > 0;
+    unsigned ry = (y & s) > 0;
+    key += (uint64_t)s * s * ((3 * rx) ^ ry);
+    if (ry == 0) {
+      if (rx == 1) {
+        x = s - 1 - x;
+        y = s - 1 - y;
+      }
+      unsigned t = x;
+      x = y;
+      y = t;
+    }
+  }
+  return key;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+/* Returns the cells of the board (as raster indices) in the order of the
+ * given space-filling curve, or NULL for the raster layout. Curves are
+ * defined on the smallest power-of-two square covering the board, so
+ * cells close on the board are mostly close in the order as well. */
+int *layout_order(int size_x, int size_y, int layout) {
+  if (layout == LAYOUT_RASTER) {
+    return NULL;
+  }
+  unsigned n = 1;
+  while (n < (unsigned)size_x || n < (unsigned)size_y) {
+    n *= 2;
+  }
+  int size = size_x * size_y;
+  uint64_t *keys = malloc(sizeof(uint64_t) * size);
+  for (int y = 0; y < size_y; ++y) {
+    for (int x = 0; x < size_x; ++x) {
+      uint64_t key = (layout == LAYOUT_MORTON)
+        ? morton_key(x, y)
+        : hilbert_key(n, x, y);
+      /* the raster index in the low bits makes keys unique */
+      keys[y * size_x + x] =
+        (key << CELL_BITS) | (uint64_t)(y * size_x + x);
+    }
+  }
+  qsort(keys, size, sizeof(uint64_t), cmp_u64);
+  int *order = malloc(sizeof(int) * size);
+  for (int t = 0; t < size; ++t) {
+    order[t] = keys[t] & ((1ull << CELL_BITS) - 1);
+  }
+  free(keys);
+  return order;
+}
@@ -0,0 +1,10 @@
+#ifndef __LAYOUT_H
+#define __LAYOUT_H
+
+#define LAYOUT_RASTER  0
+#define LAYOUT_MORTON  1
+#define LAYOUT_HILBERT 2
+
+int *layout_order(int size_x, int size_y, int layout);
+
+#endif
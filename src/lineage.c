@@ -0,0 +1,173 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "lineage.h"
+
+#include <errno.h>
+#include <error.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RING_SIZE    (1 << 16)  /* records, must be a power of two */
+#define BATCH_SIZE   1024
+#define SEGMENT_SIZE (1 << 20)  /* records per file, completed to a step */
+
+/* Each file starts with the magic, the version of the format and the size
+ * of a record, followed by records */
+#define LINEAGE_MAGIC   "TRUSTLIN"
+#define LINEAGE_VERSION 2
+
+/* Sleepers announce themselves before they check the ring for the last
+ * time, and wakers check for sleepers after they change it, so with
+ * sequentially consistent accesses no wakeup is lost */
+static void wake(lineage_t *lin, atomic_int *sleepers, pthread_cond_t *cond) {
+  if (atomic_load(sleepers) > 0) {
+    pthread_mutex_lock(&lin->lock);
+    pthread_cond_broadcast(cond);
+    pthread_mutex_unlock(&lin->lock);
+  }
+}
+
+static int slot_ready(lineage_t *lin, size_t pos, size_t seq) {
+  return atomic_load(&lin->ring[pos & (RING_SIZE - 1)].seq) == seq;
+}
+
+static void open_segment(lineage_t *lin, uint64_t step) {
+  if (lin->file != NULL) {
+    fclose(lin->file);
+  }
+  char *fname = malloc(strlen(lin->name) + 32);
+  sprintf(fname, "%s%lu.lin", lin->name, (unsigned long)step);
+  lin->file = fopen(fname, "wb");
+  if (lin->file == NULL) {
+    error(0, errno, "cannot open file `%s'", fname);
+  } else {
+    uint32_t version = LINEAGE_VERSION;
+    uint32_t size    = sizeof(lineage_record_t);
+    fwrite(LINEAGE_MAGIC, 1, 8, lin->file);
+    fwrite(&version, sizeof(version), 1, lin->file);
+    fwrite(&size, sizeof(size), 1, lin->file);
+  }
+  lin->file_records = 0;
+  free(fname);
+}
+
+/* Files are switched only between steps, so that each step is whole */
+static void write_records(
+  lineage_t *lin, const lineage_record_t *recs, size_t n)
+{
+  size_t first = 0;
+  for (size_t k = 0; k < n; ++k) {
+    if (lin->file_records + (k - first) >= SEGMENT_SIZE
+      && recs[k].step != lin->last_step)
+    {
+      if (lin->file != NULL) {
+        fwrite(&recs[first], sizeof(lineage_record_t), k - first, lin->file);
+      }
+      open_segment(lin, recs[k].step);
+      first = k;
+    }
+    lin->last_step = recs[k].step;
+  }
+  if (lin->file != NULL) {
+    fwrite(&recs[first], sizeof(lineage_record_t), n - first, lin->file);
+  }
+  lin->file_records += n - first;
+}
+
+static void *lineage_writer(void *arg) {
+  lineage_t *lin = arg;
+  lineage_record_t *buf = malloc(sizeof(lineage_record_t) * BATCH_SIZE);
+  while (1) {
+    /* read before draining: once it is set, all records are in the ring */
+    int closing = atomic_load(&lin->closing);
+    size_t n = 0;
+    while (n < BATCH_SIZE) {
+      lineage_slot_t *slot = &lin->ring[lin->tail & (RING_SIZE - 1)];
+      if (atomic_load_explicit(&slot->seq, memory_order_acquire)
+        != lin->tail + 1)
+      {
+        break;
+      }
+      buf[n++] = slot->rec;
+      atomic_store(&slot->seq, lin->tail + RING_SIZE);
+      lin->tail++;
+    }
+    if (n > 0) {
+      wake(lin, &lin->full_n, &lin->room);
+      write_records(lin, buf, n);
+    } else if (closing) {
+      break;
+    } else {
+      pthread_mutex_lock(&lin->lock);
+      atomic_store(&lin->idle, 1);
+      while (!slot_ready(lin, lin->tail, lin->tail + 1)
+        && !atomic_load(&lin->closing))
+      {
+        pthread_cond_wait(&lin->ready, &lin->lock);
+      }
+      atomic_store(&lin->idle, 0);
+      pthread_mutex_unlock(&lin->lock);
+    }
+  }
+  free(buf);
+  return NULL;
+}
+
+void lineage_open(lineage_t *lin, const char *name) {
+  lin->name = name;
+  lin->ring = malloc(sizeof(lineage_slot_t) * RING_SIZE);
+  for (size_t k = 0; k < RING_SIZE; ++k) {
+    atomic_init(&lin->ring[k].seq, k);
+  }
+  atomic_init(&lin->head, 0);
+  atomic_init(&lin->closing, 0);
+  atomic_init(&lin->full_n, 0);
+  atomic_init(&lin->idle, 0);
+  pthread_mutex_init(&lin->lock, NULL);
+  pthread_cond_init(&lin->room, NULL);
+  pthread_cond_init(&lin->ready, NULL);
+  lin->tail         = 0;
+  lin->file         = NULL;
+  lin->file_records = SEGMENT_SIZE;
+  lin->last_step    = LINEAGE_NONE;
+  int err = pthread_create(&lin->writer, NULL, lineage_writer, lin);
+  if (err != 0) {
+    error(EXIT_FAILURE, err, "cannot start the lineage writer");
+  }
+}
+
+/* Must not be called while records are appended */
+void lineage_close(lineage_t *lin) {
+  atomic_store(&lin->closing, 1);
+  wake(lin, &lin->idle, &lin->ready);
+  pthread_join(lin->writer, NULL);
+  if (lin->file != NULL) {
+    fclose(lin->file);
+  }
+  pthread_mutex_destroy(&lin->lock);
+  pthread_cond_destroy(&lin->room);
+  pthread_cond_destroy(&lin->ready);
+  free(lin->ring);
+}
+
+/* Appends n consecutive records. Safe to call from many threads at once.
+ * When the ring is full, sleeps until the writer makes room, so no record
+ * is lost. */
+void lineage_append(lineage_t *lin, const lineage_record_t *rec, size_t n) {
+  size_t pos = atomic_fetch_add_explicit(&lin->head, n, memory_order_relaxed);
+  for (size_t k = 0; k < n; ++k, ++pos) {
+    lineage_slot_t *slot = &lin->ring[pos & (RING_SIZE - 1)];
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos) {
+      pthread_mutex_lock(&lin->lock);
+      atomic_fetch_add(&lin->full_n, 1);
+      while (!slot_ready(lin, pos, pos)) {
+        pthread_cond_wait(&lin->room, &lin->lock);
+      }
+      atomic_fetch_sub(&lin->full_n, 1);
+      pthread_mutex_unlock(&lin->lock);
+    }
+    slot->rec = rec[k];
+    atomic_store(&slot->seq, pos + 1);
+  }
+  wake(lin, &lin->idle, &lin->ready);
+}
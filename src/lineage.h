@@ -0,0 +1,85 @@
+#ifndef __LINEAGE_H
+#define __LINEAGE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define LINEAGE_BIRTH 0
+#define LINEAGE_DEATH 1
+
+#define LINEAGE_NONE  UINT64_MAX
+
+#define LINEAGE_BATCH 64
+
+/* Record of a birth or a death of an automaton. Parents of a birth are
+ * given by their ids, parents of a death are LINEAGE_NONE; the genome is
+ * given by the hash of its play table. Files hold records in native byte
+ * order, after a header (see lineage.c). */
+typedef struct lineage_record {
+  uint64_t step;
+  uint64_t id;
+  uint64_t parent[2];
+  uint64_t hash;
+  uint32_t cell;
+  uint32_t event;
+} lineage_record_t;
+
+typedef struct lineage_slot {
+  lineage_record_t rec;
+  atomic_size_t    seq;
+} lineage_slot_t;
+
+/* Records gathered by one thread, to be appended at once */
+typedef struct lineage_batch {
+  lineage_record_t rec[LINEAGE_BATCH];
+  int              n;
+} lineage_batch_t;
+
+/* Bounded ring of records, filled by any number of threads and drained
+ * by the writer thread into files NAME<n>.lin, where <n> is the step of
+ * the first record in the file. Threads that find the ring full, and the
+ * writer when it is empty, sleep on the condition variables. */
+typedef struct lineage {
+  const char     *name;
+  lineage_slot_t *ring;
+  atomic_size_t   head;
+  size_t          tail;
+  atomic_int      closing;
+  atomic_int      full_n;       /* producers waiting for room */
+  atomic_int      idle;         /* the writer waits for records */
+  pthread_mutex_t lock;
+  pthread_cond_t  room;
+  pthread_cond_t  ready;
+  pthread_t       writer;
+  FILE           *file;
+  size_t          file_records;
+  uint64_t        last_step;
+} lineage_t;
+
+void lineage_open(lineage_t *lin, const char *name);
+void lineage_close(lineage_t *lin);
+void lineage_append(lineage_t *lin, const lineage_record_t *rec, size_t n);
+
+static inline void lineage_batch_init(lineage_batch_t *batch) {
+  batch->n = 0;
+}
+
+static inline void lineage_flush(lineage_t *lin, lineage_batch_t *batch) {
+  if (batch->n > 0) {
+    lineage_append(lin, batch->rec, batch->n);
+    batch->n = 0;
+  }
+}
+
+static inline void lineage_push(
+  lineage_t *lin, lineage_batch_t *batch, const lineage_record_t *rec)
+{
+  batch->rec[batch->n++] = *rec;
+  if (batch->n == LINEAGE_BATCH) {
+    lineage_flush(lin, batch);
+  }
+}
+
+#endif
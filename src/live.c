@@ -0,0 +1,125 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "live.h"
+
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ALIGN(x) (((x) + 63) & ~(size_t)63)
+
+static size_t frame_size(int n) {
+  return ALIGN(sizeof(live_frame_t) + (sizeof(int32_t) + sizeof(uint32_t)
+    + sizeof(uint8_t)) * (size_t)n);
+}
+
+/* A segment is stale only if it was made by this program, and its owner
+ * is gone. Segments without the magic may be foreign, or made by a process
+ * that has not written it yet, and are never taken. */
+static int live_stale(const char *name) {
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    return errno == ENOENT;
+  }
+  struct stat st;
+  int stale = 0;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(live_header_t)) {
+    live_header_t *h = mmap(NULL, sizeof(live_header_t), PROT_READ,
+      MAP_SHARED, fd, 0);
+    if (h != MAP_FAILED) {
+      if (memcmp(h->magic, LIVE_MAGIC, 8) == 0 && h->owner != 0
+        && kill(h->owner, 0) != 0 && errno == ESRCH)
+      {
+        stale = 1;
+      }
+      munmap(h, sizeof(live_header_t));
+    }
+  }
+  close(fd);
+  return stale;
+}
+
+void live_open(live_t *live, const char *name, int size_x, int size_y) {
+  size_t n_size = frame_size(size_x * size_y);
+  live->name = name;
+  live->size = ALIGN(sizeof(live_header_t)) + 2 * n_size;
+
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (fd < 0 && errno == EEXIST) {
+    if (!live_stale(name)) {
+      error(EXIT_FAILURE, 0, "shared memory `%s' is used by another process "
+        "or is not a segment of trust", name);
+    }
+    shm_unlink(name);
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+  }
+  if (fd < 0) {
+    error(EXIT_FAILURE, errno, "cannot open shared memory `%s'", name);
+  }
+  if (ftruncate(fd, live->size) != 0) {
+    error(EXIT_FAILURE, errno, "cannot resize shared memory `%s'", name);
+  }
+  live->header = mmap(NULL, live->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+    fd, 0);
+  if (live->header == MAP_FAILED) {
+    error(EXIT_FAILURE, errno, "cannot map shared memory `%s'", name);
+  }
+  close(fd);
+
+  live_header_t *h = live->header;
+  memset(h, 0, live->size);
+  h->version         = LIVE_VERSION;
+  h->size_x          = size_x;
+  h->size_y          = size_y;
+  h->owner           = getpid();
+  h->frame_size      = n_size;
+  h->frame_offset[0] = ALIGN(sizeof(live_header_t));
+  h->frame_offset[1] = ALIGN(sizeof(live_header_t)) + n_size;
+  atomic_init(&h->seq, 0);
+  /* the magic goes last, so readers never see a half-made header */
+  atomic_thread_fence(memory_order_release);
+  memcpy(h->magic, LIVE_MAGIC, 8);
+}
+
+void live_close(live_t *live) {
+  munmap(live->header, live->size);
+  shm_unlink(live->name);
+}
+
+/* Writes the frame that readers do not look at, then makes it the latest
+ * one. Readers of the previous frame are never disturbed; readers of the
+ * one written see the odd seq before any of its contents. */
+void live_publish(
+  live_t         *live,
+  unsigned long   step,
+  double          avg_score,
+  const int      *score,
+  const unsigned *color,
+  const char     *status)
+{
+  live_header_t *h = live->header;
+  size_t   n   = (size_t)h->size_x * h->size_y;
+  uint64_t seq = atomic_load_explicit(&h->seq, memory_order_relaxed);
+  char    *buf = (char *)h + h->frame_offset[(seq / 2 + 1) % 2];
+
+  atomic_store_explicit(&h->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  live_frame_t *frame = (live_frame_t *)buf;
+  frame->step      = step;
+  frame->avg_score = avg_score;
+  buf += sizeof(live_frame_t);
+  memcpy(buf, score, sizeof(int32_t) * n);
+  buf += sizeof(int32_t) * n;
+  memcpy(buf, color, sizeof(uint32_t) * n);
+  buf += sizeof(uint32_t) * n;
+  memcpy(buf, status, sizeof(uint8_t) * n);
+
+  atomic_store_explicit(&h->seq, seq + 2, memory_order_release);
+}
@@ -0,0 +1,51 @@
+#ifndef __LIVE_H
+#define __LIVE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LIVE_MAGIC   "TRUSTLIV"
+#define LIVE_VERSION 2
+
+/* Layout of the shared memory segment. The header is followed by two
+ * frames, each holding the step, the average score and then arrays of
+ * int32_t scores, uint32_t colours and uint8_t statuses of all cells.
+ * seq is twice the number of published frames, plus one while the next
+ * frame is being written; the latest one is frame[seq / 2 % 2]. A reader
+ * reads seq (s1), then the frame, then seq again (s2); the frame is
+ * consistent if s2 - s1 / 2 * 2 <= 2, i.e., if the writer has not started
+ * on it again. owner is the pid of the writing process. */
+typedef struct live_header {
+  char             magic[8];
+  uint32_t         version;
+  uint32_t         size_x;
+  uint32_t         size_y;
+  uint32_t         owner;
+  uint64_t         frame_size;
+  uint64_t         frame_offset[2];
+  _Atomic uint64_t seq;
+} live_header_t;
+
+typedef struct live_frame {
+  uint64_t step;
+  double   avg_score;
+} live_frame_t;
+
+typedef struct live {
+  const char    *name;
+  size_t         size;
+  live_header_t *header;
+} live_t;
+
+void live_open(live_t *live, const char *name, int size_x, int size_y);
+void live_close(live_t *live);
+void live_publish(
+  live_t         *live,
+  unsigned long   step,
+  double          avg_score,
+  const int      *score,
+  const unsigned *color,
+  const char     *status);
+
+#endif
@@ -1,4 +1,5 @@
 #include <argp.h>
+#include <error.h>
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
@@ -7,29 +8,8 @@
 #define STR_(x) #x
 #define STR(x) STR_(x)
 
-#define DFLT_BOARD_SIZE          32
-#define DFLT_STATES              32
-#define DFLT_STEPS               0
-#define DFLT_TURNS               16
-#define DFLT_PLAY_AREA           3
-#define DFLT_KILL_AREA           2
-#define DFLT_CROSS_AREA          4
-#define DFLT_LIFETIME            2000
-#define DFLT_STAT_REPORT_RATE    1
-#define DFLT_STAT_FLUSH_RATE     10
-#define DFLT_EXAMPLE_RATE        200
-#define DFLT_IMAGE_RATE          10
-#define DFLT_BACKUP_RATE         1000
-#define DFLT_SEED                1337
-#define DFLT_MISTAKE_RATE        0.0
-#define DFLT_CROSS_RATE          0.0
-#define DFLT_STATE_MUT_RATE      0.01
-#define DFLT_ACTION_MUT_RATE     0.01
-#define DFLT_EDGE_MUT_RATE       0.01
-#define DFLT_STAT_FILE           NULL
-#define DFLT_EXAMPLE_NAME        NULL
-#define DFLT_IMAGE_NAME          NULL
-
+#include "control.h"
+#include "islands.h"
 #include "settings.h"
 #include "world.h"
 
@@ -100,6 +80,34 @@ static const char doc[] =
 #define OPT_SEED             130
 #define OPT_CONTINUE         131
 #define OPT_BACKUP_RATE      132
+#define OPT_LAYOUT           133
+#define OPT_TOPOLOGY         134
+#define OPT_GRAPH_FILE       135
+#define OPT_REWIRE_RATE      136
+#define OPT_ATTACH_N         137
+#define OPT_PAYOFF           138
+#define OPT_STEADY_WINDOW    139
+#define OPT_STEADY_TOLERANCE 140
+#define OPT_STEADY_POLICY    141
+#define OPT_LINEAGE          142
+#define OPT_HISTORY          143
+#define OPT_KEYFRAME_RATE    144
+#define OPT_REPLAY           145
+#define OPT_LIVE             146
+#define OPT_CONTROL          147
+#define OPT_SPECIES          148
+#define OPT_TRANSCRIPT       149
+#define OPT_TRANSCRIPT_RATE  150
+#define OPT_TRANSCRIPT_CELLS 151
+#define OPT_PNG_LEVEL        152
+#define OPT_PNG_FILTER       153
+#define OPT_TILES            154
+#define OPT_PERSIST          155
+#define OPT_ISLANDS          156
+#define OPT_MIGRATION_RATE   157
+#define OPT_MIGRANTS         158
+#define OPT_MIGRATION        159
+#define OPT_CHECK_LOAD       160
 
 static struct argp_option options[] =
   { { "board-size", OPT_BOARD_SIZE, "SIZE", 0,
@@ -144,12 +152,27 @@ static struct argp_option options[] =
       "Write example automata to NAME<n>.gv, where <n> is a step number" }
   , { "image-name", OPT_IMAGE_NAME, "NAME", 0,
       "Write images to NAME<n>.png, where <n> is a step number" }
+  , { "tiles", OPT_TILES, "DIR", 0,
+      "Draw images also as a pyramid of tiles in DIR, for zooming into "
+      "large boards. Only tiles that have changed are written" }
+  , { "png-level", OPT_PNG_LEVEL, "LEVEL", 0,
+      "Specify the compression level of images, from 0 (none) to 9 (best) "
+      "(default is " STR(DFLT_PNG_LEVEL) ")" }
+  , { "png-filter", OPT_PNG_FILTER, "FILTER", 0,
+      "Specify the PNG filter of image rows: none, sub, up, average, paeth "
+      "or adaptive (default; the best one for each row)" }
   , { "quiet", OPT_QUIET, 0, 0,
       "Be quiet" }
   , { "species-map", OPT_SPECIES_MAP, 0, 0,
       "Show species map on images" }
   , { "no-species-map", OPT_NO_SPECIES_MAP, 0, 0,
       "Do not show species map on images (default)" }
+  , { "species", OPT_SPECIES, "KIND", 0,
+      "Specify what makes a species: lineage (default; colours drift "
+      "randomly from parents to children) or behaviour (automata that "
+      "play alike are of the same species and have similar colours). "
+      "With behaviour, the number of species is the third column of the "
+      "stat file" }
   , { "seed", OPT_SEED, "SEED", 0,
       "Set the seed of pseudo-random number generator "
       "(default is " STR(DFLT_SEED) ")" }
@@ -181,13 +204,110 @@ static struct argp_option options[] =
   , { "show-unreachable-states", OPT_SHOW_UNREACHABLE, 0, 0,
       "Show unreachable states in example automata" }
   , { "continue", OPT_CONTINUE, 0, 0,
-      "Continue from the saved state. Other options are ignored" }
+      "Continue from the saved state. Other options are ignored, except "
+      "--persist, --control and options of islands" }
+  , { "persist", OPT_PERSIST, "FILE", 0,
+      "Keep automata in FILE mapped into memory, instead of saving the "
+      "world file. Backups are checkpoints of the mapping, and with "
+      "--continue the world is restarted from FILE at once" }
   , { "backup-rate", OPT_BACKUP_RATE, "N", 0,
       "Backup state every N steps (default is 1000)" }
+  , { "layout", OPT_LAYOUT, "LAYOUT", 0,
+      "Store and traverse automata along a space-filling curve. "
+      "LAYOUT is one of raster (default), morton or hilbert" }
+  , { "topology", OPT_TOPOLOGY, "NAME", 0,
+      "Specify the graph of interactions between automata. NAME is one of "
+      "torus (default), von-neumann, hex, small-world or scale-free. "
+      "For other topologies than torus, sizes of areas are measured in "
+      "hops, and vertices are cells of the board" }
+  , { "graph-file", OPT_GRAPH_FILE, "FILE", 0,
+      "Read the graph of interactions from FILE, containing one edge "
+      "(a pair of vertex numbers, counted from 0) per line. The number of "
+      "vertices is given by the board size" }
+  , { "rewire-rate", OPT_REWIRE_RATE, "RATE", 0,
+      "Specify the probability, that an edge of the small-world graph is "
+      "rewired (default is " STR(DFLT_REWIRE_RATE) ")" }
+  , { "attach", OPT_ATTACH_N, "N", 0,
+      "Specify the number of edges of each new vertex of the scale-free "
+      "graph (default is " STR(DFLT_ATTACH_N) ")" }
+  , { "payoff", OPT_PAYOFF, "MATRIX", 0,
+      "Specify the payoff matrix of the game, either as a name of a known "
+      "game: prisoner (default), snowdrift, stag-hunt or harmony, or as four "
+      "integers R,S,T,P, which are the payoffs for mutual cooperation, "
+      "cooperation against defection, defection against cooperation and "
+      "mutual defection" }
+  , { "steady-window", OPT_STEADY_WINDOW, "N", 0,
+      "Detect the steady state, in which genomes of automata did not change "
+      "and the average score stayed within the tolerance for N steps "
+      "(default is 0, which disables the detection)" }
+  , { "steady-tolerance", OPT_STEADY_TOLERANCE, "RATE", 0,
+      "Specify the largest standard deviation of the average score in the "
+      "steady state, relative to its mean "
+      "(default is " STR(DFLT_STEADY_TOLERANCE) ")" }
+  , { "steady-policy", OPT_STEADY_POLICY, "POLICY", 0,
+      "Specify what to do in the steady state. POLICY is one of stop "
+      "(default), backup (backup state and stop) or throttle (report "
+      "100 times less often)" }
+  , { "lineage", OPT_LINEAGE, "NAME", 0,
+      "Log births and deaths of automata to binary files NAME<n>.lin, where "
+      "<n> is the step of the first record in a file" }
+  , { "history", OPT_HISTORY, "NAME", 0,
+      "Keep the history of the world in files NAME<n>.key (the world at "
+      "step <n>) and NAME<n>.dlt (scores changed and automata born since)" }
+  , { "keyframe-rate", OPT_KEYFRAME_RATE, "N", 0,
+      "Save the whole world to the history every N steps "
+      "(default is " STR(DFLT_KEYFRAME_RATE) ")" }
+  , { "replay", OPT_REPLAY, "STEP", 0,
+      "Reconstruct the world at STEP from the history, and write its image "
+      "and example automaton. Options other than --history, --image-name "
+      "and --example-name are ignored" }
+  , { "check-load", OPT_CHECK_LOAD, "FILE", 0,
+      "Load world FILE with both the mapped and the stdio reader, check "
+      "that they give the same world, and exit" }
+  , { "live", OPT_LIVE, "NAME", 0,
+      "Publish scores, colours and statuses of automata after each step in "
+      "POSIX shared memory object NAME (e.g., /trust), described in live.h" }
+  , { "transcript", OPT_TRANSCRIPT, "FILE", 0,
+      "Record sampled games turn by turn (states, decisions, mistakes and "
+      "actions of both players) in binary FILE, which can be read by "
+      "trust-transcript" }
+  , { "transcript-rate", OPT_TRANSCRIPT_RATE, "RATE", 0,
+      "Specify the fraction of games recorded in the transcript "
+      "(default is " STR(DFLT_TRANSCRIPT_RATE) ")" }
+  , { "transcript-cells", OPT_TRANSCRIPT_CELLS, "LIST", 0,
+      "Record in the transcript all games of automata in cells in LIST, "
+      "separated by commas. The cell at (x, y) is y * SIZE_X + x" }
+  , { "control", OPT_CONTROL, "PATH", 0,
+      "Accept commands on UNIX socket PATH, one per line: step, stats, "
+      "timings, checkpoint, image, set RATE N (RATE is image_rate, "
+      "example_rate or stat_report_rate), pause, resume and help. "
+      "Honoured also with --continue" }
+  , { "islands", OPT_ISLANDS, "N", 0,
+      "Evolve N worlds in parallel, each on its share of cores and with its "
+      "own seed (SEED + k for island k), exchanging automata from time to "
+      "time. Names of files get the suffix .k (prefixes of images and "
+      "examples get k_). The run is saved only with --persist, one file "
+      "per island" }
+  , { "migration-rate", OPT_MIGRATION_RATE, "N", 0,
+      "Exchange automata between islands every N steps (default is "
+      STR(DFLT_MIGRATION_RATE) ")" }
+  , { "migrants", OPT_MIGRANTS, "N", 0,
+      "Specify the number of automata with best scores that each island "
+      "sends, replacing those with worst scores (default is "
+      STR(DFLT_MIGRANT_N) ")" }
+  , { "migration", OPT_MIGRATION, "TOPOLOGY", 0,
+      "Specify where islands send automata. TOPOLOGY is one of ring "
+      "(to the next island, default), full (to all other islands) or "
+      "random (to another island picked at each migration)" }
   , { 0 }
   };
 
 static int should_continue = 0;
+static int replay_step     = -1;
+static const char *check_load_name = NULL;
+static const char *control_path = NULL;
+static islands_spec_t islands    =
+  { 0, DFLT_MIGRATION_RATE, DFLT_MIGRANT_N, MIGRATION_RING };
 
 static void parse_size_opt(char *arg, struct argp_state *state);
 
@@ -263,6 +383,30 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
   case OPT_IMAGE_NAME:
     settings->image_name = arg;
     break;
+  case OPT_TILES:
+    settings->tiles_name = arg;
+    break;
+  case OPT_PNG_LEVEL:
+    check_arg_range(arg, &settings->png_level, 0, MAX_PNG_LEVEL, state,
+      "The compression level");
+    break;
+  case OPT_PNG_FILTER:
+    if (strcmp(arg, "none") == 0) {
+      settings->png_filter = PNG_FILTER_NONE;
+    } else if (strcmp(arg, "sub") == 0) {
+      settings->png_filter = PNG_FILTER_SUB;
+    } else if (strcmp(arg, "up") == 0) {
+      settings->png_filter = PNG_FILTER_UP;
+    } else if (strcmp(arg, "average") == 0) {
+      settings->png_filter = PNG_FILTER_AVG;
+    } else if (strcmp(arg, "paeth") == 0) {
+      settings->png_filter = PNG_FILTER_PAETH;
+    } else if (strcmp(arg, "adaptive") == 0) {
+      settings->png_filter = PNG_FILTER_ADAPTIVE;
+    } else {
+      argp_error(state, "Unknown PNG filter `%s'.", arg);
+    }
+    break;
   case OPT_QUIET:
     settings->flags |= F_QUIET;
     break;
@@ -272,6 +416,15 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
   case OPT_NO_SPECIES_MAP:
     settings->flags &= ~F_SPECIES_MAP;
     break;
+  case OPT_SPECIES:
+    if (strcmp(arg, "behaviour") == 0) {
+      settings->flags |= F_SPECIES_BEHAVE;
+    } else if (strcmp(arg, "lineage") == 0) {
+      settings->flags &= ~F_SPECIES_BEHAVE;
+    } else {
+      argp_error(state, "Unknown kind of species `%s'.", arg);
+    }
+    break;
   case OPT_SEED:
     settings->seed = atol(arg);
     break;
@@ -305,10 +458,126 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
   case OPT_CONTINUE:
     should_continue = 1;
     break;
+  case OPT_PERSIST:
+    settings->persist_name = arg;
+    break;
   case OPT_BACKUP_RATE:
     check_arg_range(arg, &settings->backup_rate, 1, MAX_REPORT_RATE,
       state, "The rate");
     break;
+  case OPT_LAYOUT:
+    settings->flags &= ~(F_LAYOUT_MORTON | F_LAYOUT_HILBERT);
+    if (strcmp(arg, "morton") == 0) {
+      settings->flags |= F_LAYOUT_MORTON;
+    } else if (strcmp(arg, "hilbert") == 0) {
+      settings->flags |= F_LAYOUT_HILBERT;
+    } else if (strcmp(arg, "raster") != 0) {
+      argp_error(state, "Unknown layout `%s'.", arg);
+    }
+    break;
+  case OPT_TOPOLOGY:
+    if (strcmp(arg, "torus") == 0) {
+      settings->topology = TOPOLOGY_TORUS;
+    } else if (strcmp(arg, "von-neumann") == 0) {
+      settings->topology = TOPOLOGY_VON_NEUMANN;
+    } else if (strcmp(arg, "hex") == 0) {
+      settings->topology = TOPOLOGY_HEX;
+    } else if (strcmp(arg, "small-world") == 0) {
+      settings->topology = TOPOLOGY_SMALL_WORLD;
+    } else if (strcmp(arg, "scale-free") == 0) {
+      settings->topology = TOPOLOGY_SCALE_FREE;
+    } else {
+      argp_error(state, "Unknown topology `%s'.", arg);
+    }
+    break;
+  case OPT_GRAPH_FILE:
+    settings->topology   = TOPOLOGY_FILE;
+    settings->graph_file = arg;
+    break;
+  case OPT_REWIRE_RATE:
+    settings->rewire_rate = fpoint(atof(arg));
+    break;
+  case OPT_ATTACH_N:
+    check_arg_range(arg, &settings->attach_n, 1, MAX_ATTACH_N, state,
+      "The number of edges");
+    break;
+  case OPT_PAYOFF:
+    if (parse_payoff(arg, settings)) {
+      argp_error(state, "Invalid payoff matrix `%s'.", arg);
+    }
+    break;
+  case OPT_STEADY_WINDOW:
+    check_arg_range(arg, &settings->steady_window, 0, MAX_STEADY_WIN, state,
+      "The steady state window");
+    break;
+  case OPT_STEADY_TOLERANCE:
+    settings->steady_tolerance = fpoint(atof(arg));
+    break;
+  case OPT_STEADY_POLICY:
+    if (strcmp(arg, "stop") == 0) {
+      settings->steady_policy = STEADY_STOP;
+    } else if (strcmp(arg, "backup") == 0) {
+      settings->steady_policy = STEADY_BACKUP;
+    } else if (strcmp(arg, "throttle") == 0) {
+      settings->steady_policy = STEADY_THROTTLE;
+    } else {
+      argp_error(state, "Unknown steady state policy `%s'.", arg);
+    }
+    break;
+  case OPT_LINEAGE:
+    settings->lineage_name = arg;
+    break;
+  case OPT_LIVE:
+    settings->live_name = arg;
+    break;
+  case OPT_HISTORY:
+    settings->history_name = arg;
+    break;
+  case OPT_KEYFRAME_RATE:
+    check_arg_range(arg, &settings->keyframe_rate, 1, MAX_REPORT_RATE, state,
+      "The keyframe rate");
+    break;
+  case OPT_TRANSCRIPT:
+    settings->transcript_name = arg;
+    break;
+  case OPT_TRANSCRIPT_RATE:
+    settings->transcript_rate = fpoint(atof(arg));
+    break;
+  case OPT_TRANSCRIPT_CELLS:
+    settings->transcript_cells = arg;
+    break;
+  case OPT_CONTROL:
+    control_path = arg;
+    break;
+  case OPT_ISLANDS:
+    check_arg_range(arg, &islands.n, 1, MAX_ISLAND_N, state,
+      "The number of islands");
+    break;
+  case OPT_MIGRATION_RATE:
+    check_arg_range(arg, &islands.rate, 1, MAX_STEP_N, state, "The rate");
+    break;
+  case OPT_MIGRANTS:
+    check_arg_range(arg, &islands.migrant_n, 0,
+      MAX_BOARD_SIZE * MAX_BOARD_SIZE, state, "The number of migrants");
+    break;
+  case OPT_MIGRATION:
+    if (strcmp(arg, "ring") == 0) {
+      islands.topology = MIGRATION_RING;
+    } else if (strcmp(arg, "full") == 0) {
+      islands.topology = MIGRATION_FULL;
+    } else if (strcmp(arg, "random") == 0) {
+      islands.topology = MIGRATION_RANDOM;
+    } else {
+      argp_error(state, "Unknown migration topology `%s'.", arg);
+    }
+    break;
+  case OPT_REPLAY:
+    check_arg_range(arg, &replay_step, 0, MAX_STEP_N, state,
+      "The replayed step");
+    break;
+  case OPT_CHECK_LOAD:
+    check_load_name = arg;
+    break;
   case ARGP_KEY_ARG:
     argp_usage(state);
     break;
@@ -344,42 +613,72 @@ static struct argp argp = { options, parse_opt, 0, doc, 0, 0, 0 };
 
 volatile static sig_atomic_t kill_received = 0;
 
+static void (*const phases[PHASE_N])(world_t *) =
+  { [PHASE_RESET]  = world_reset
+  , [PHASE_PLAY]   = world_play
+  , [PHASE_KILL]   = world_kill_weak
+  , [PHASE_SPAWN]  = world_spawn_new
+  , [PHASE_REPORT] = world_report
+  };
+
 void kill_handler(int signo) {
   kill_received = 1;
 }
 
+/* Islands are saved only in persistent files, and features that expect a
+ * single world are refused */
+static void run_islands(const settings_t *settings) {
+  if (settings->history_name != NULL) {
+    error(EXIT_FAILURE, 0, "--islands cannot be used with --history");
+  }
+  if (control_path != NULL) {
+    error(EXIT_FAILURE, 0, "--islands cannot be used with --control");
+  }
+  if (settings->stat_file != NULL && strcmp(settings->stat_file, "-") == 0)
+  {
+    error(EXIT_FAILURE, 0, "--islands cannot write statistics to stdout");
+  }
+  if (settings->persist_name == NULL
+    && (should_continue || settings->steady_policy == STEADY_BACKUP))
+  {
+    error(EXIT_FAILURE, 0, "islands are saved only with --persist");
+  }
+  signal(SIGINT, kill_handler);
+  islands_run(settings, &islands, should_continue, &kill_received);
+  if ((settings->flags & F_QUIET) == 0) {
+    printf("\n");
+  }
+}
+
 int main(int argc, char **argv) {
-  world_t world =
-    { .settings = 
-      { .board_size_x       = DFLT_BOARD_SIZE
-      , .board_size_y       = DFLT_BOARD_SIZE
-      , .state_n            = DFLT_STATES
-      , .step_n             = DFLT_STEPS
-      , .turn_n             = DFLT_TURNS
-      , .play_area          = DFLT_PLAY_AREA
-      , .kill_area          = DFLT_KILL_AREA
-      , .cross_area         = DFLT_CROSS_AREA
-      , .lifetime           = DFLT_LIFETIME
-      , .stat_report_rate   = DFLT_STAT_REPORT_RATE
-      , .stat_flush_rate    = DFLT_STAT_FLUSH_RATE
-      , .example_rate       = DFLT_EXAMPLE_RATE
-      , .image_rate         = DFLT_IMAGE_RATE
-      , .backup_rate        = DFLT_BACKUP_RATE
-      , .flags              = 0
-      , .seed               = DFLT_SEED
-      , .mistake_rate       = fpoint(DFLT_MISTAKE_RATE)
-      , .cross_rate         = fpoint(DFLT_CROSS_RATE)
-      , .state_mut_rate     = fpoint(DFLT_STATE_MUT_RATE)
-      , .action_mut_rate    = fpoint(DFLT_ACTION_MUT_RATE)
-      , .edge_mut_rate      = fpoint(DFLT_EDGE_MUT_RATE)
-      , .stat_file          = DFLT_STAT_FILE
-      , .example_name       = DFLT_EXAMPLE_NAME
-      , .image_name         = DFLT_IMAGE_NAME
-      }
-    };
+  world_t world;
+  settings_default(&world.settings);
 
   argp_parse(&argp, argc, argv, 0, 0, &world.settings);
-  if (should_continue) {
+  if (check_load_name != NULL) {
+    const char *diff = world_check_load(check_load_name);
+    if (diff != NULL) {
+      error(EXIT_FAILURE, 0, "readers of `%s' differ (at %s)",
+        check_load_name, diff);
+    }
+    printf("Readers of `%s' agree\n", check_load_name);
+    return 0;
+  }
+  if (replay_step >= 0) {
+    if (world.settings.history_name == NULL) {
+      error(EXIT_FAILURE, 0, "--replay requires --history");
+    }
+    world_replay(&world, replay_step);
+    world_destroy(&world);
+    return 0;
+  }
+  if (islands.n > 0) {
+    run_islands(&world.settings);
+    return 0;
+  }
+  if (should_continue && world.settings.persist_name != NULL) {
+    world_attach(&world, world.settings.persist_name);
+  } else if (should_continue) {
     world_deserialize(&world);
   } else {
     world_init(&world);
@@ -387,6 +686,12 @@ int main(int argc, char **argv) {
 
   signal(SIGINT, kill_handler);
 
+  control_t control;
+  double    phase_time[PHASE_N] = { 0.0 };
+  if (control_path != NULL) {
+    control_open(&control, control_path, &world, &kill_received);
+  }
+
   do {
     if (kill_received) {
       world_serialize(&world);
@@ -395,16 +700,22 @@ int main(int argc, char **argv) {
     if (world.step %world.settings.backup_rate == 0) {
       world_serialize(&world);
     }
-    world_reset(&world);
-    world_play(&world);
-    world_kill_weak(&world);
-    world_spawn_new(&world);
-    world_report(&world);
+    for (int p = 0; p < PHASE_N; ++p) {
+      double start = control_clock();
+      phases[p](&world);
+      phase_time[p] = control_clock() - start;
+    }
+    if (control_path != NULL) {
+      control_sync(&control, &world, phase_time);
+    }
   } while (world_next_step(&world));
 
   if ((world.settings.flags & F_QUIET) == 0) {
     printf("\n");
   }
+  if (control_path != NULL) {
+    control_close(&control);
+  }
   world_destroy(&world);
   return 0;
 }
@@ -9,10 +9,15 @@
  *
  * Apr, 2020 -- added fixed-point representation and serialization
  *   author: Piotr Polesiuk
+ *
+ * Oct, 2026 -- added geometric gaps between rare events, bounded integers
+ *   and block generation of tempered words (vectorised with AVX2), and
+ *   keyed SplitMix64 streams
  */
 
 #define UPPER_MASK		0x80000000
 #define LOWER_MASK		0x7fffffff
+#define MATRIX_A		0x9908b0df
 #define TEMPERING_MASK_B	0x9d2c5680
 #define TEMPERING_MASK_C	0xefc60000
 
@@ -20,11 +25,17 @@
 
 #include "serialization.h"
 
-inline void m_seedRand(MTRand* rand, unsigned long seed) {
+#include <math.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+static void m_seedRand(MTRand* rand, unsigned long seed) {
   /* set initial seeds to mt[STATE_VECTOR_LENGTH] using the generator
    * from Line 25 of Table 1 in: Donald Knuth, "The Art of Computer
    * Programming," Vol. 2 (2nd Ed.) pp.102.
    */
+  rand->keyed = 0;
   rand->mt[0] = seed & 0xffffffff;
   for(rand->index=1; rand->index<STATE_VECTOR_LENGTH; rand->index++) {
     rand->mt[rand->index] = (6069 * rand->mt[rand->index-1]) & 0xffffffff;
@@ -41,31 +52,31 @@ MTRand seedRand(unsigned long seed) {
 }
 
 /**
- * Generates a pseudo-randomly generated long.
- */
-unsigned long genRandLong(MTRand* rand) {
-
-  unsigned long y;
-  static unsigned long mag[2] = {0x0, 0x9908b0df}; /* mag[x] = x * 0x9908b0df for x = 0,1 */
-  if(rand->index >= STATE_VECTOR_LENGTH || rand->index < 0) {
-    /* generate STATE_VECTOR_LENGTH words at a time */
-    int kk;
-    if(rand->index >= STATE_VECTOR_LENGTH+1 || rand->index < 0) {
-      m_seedRand(rand, 4357);
-    }
-    for(kk=0; kk<STATE_VECTOR_LENGTH-STATE_VECTOR_M; kk++) {
-      y = (rand->mt[kk] & UPPER_MASK) | (rand->mt[kk+1] & LOWER_MASK);
-      rand->mt[kk] = rand->mt[kk+STATE_VECTOR_M] ^ (y >> 1) ^ mag[y & 0x1];
-    }
-    for(; kk<STATE_VECTOR_LENGTH-1; kk++) {
-      y = (rand->mt[kk] & UPPER_MASK) | (rand->mt[kk+1] & LOWER_MASK);
-      rand->mt[kk] = rand->mt[kk+(STATE_VECTOR_M-STATE_VECTOR_LENGTH)] ^ (y >> 1) ^ mag[y & 0x1];
-    }
-    y = (rand->mt[STATE_VECTOR_LENGTH-1] & UPPER_MASK) | (rand->mt[0] & LOWER_MASK);
-    rand->mt[STATE_VECTOR_LENGTH-1] = rand->mt[STATE_VECTOR_M-1] ^ (y >> 1) ^ mag[y & 0x1];
-    rand->index = 0;
-  }
-  y = rand->mt[rand->index++];
+* Restarts an existing generator as a SplitMix64 stream keyed by all 64
+* bits of key. It costs nothing to start, so it suits short streams, e.g.,
+* one per birth.
+*/
+void keyRand(MTRand* rand, uint64_t key) {
+  rand->keyed = 1;
+  rand->state = key;
+  rand->index = STATE_VECTOR_LENGTH;
+}
+
+static void m_refillKeyed(MTRand* rand) {
+  int kk = STATE_VECTOR_LENGTH - KEYED_BLOCK_LENGTH;
+  for (rand->index = kk; kk < STATE_VECTOR_LENGTH; kk += 2) {
+    uint64_t z = mix64(rand->state += 0x9e3779b97f4a7c15ull);
+    rand->out[kk]   = (uint32_t)z;
+    rand->out[kk+1] = (uint32_t)(z >> 32);
+  }
+}
+
+static inline uint32_t m_twist(uint32_t mt0, uint32_t mt1, uint32_t mtm) {
+  uint32_t y = (mt0 & UPPER_MASK) | (mt1 & LOWER_MASK);
+  return mtm ^ (y >> 1) ^ (-(y & 0x1) & MATRIX_A);
+}
+
+static inline uint32_t m_temper(uint32_t y) {
   y ^= (y >> 11);
   y ^= (y << 7) & TEMPERING_MASK_B;
   y ^= (y << 15) & TEMPERING_MASK_C;
@@ -73,6 +84,87 @@ unsigned long genRandLong(MTRand* rand) {
   return y;
 }
 
+#ifdef __AVX2__
+/* Computes mt[kk..kk+7] from mt[kk..kk+8] and mt[mm..mm+7]. */
+static inline void m_twist8(uint32_t *mt, int kk, int mm) {
+  const __m256i upper = _mm256_set1_epi32(UPPER_MASK);
+  const __m256i lower = _mm256_set1_epi32(LOWER_MASK);
+  const __m256i one   = _mm256_set1_epi32(0x1);
+  const __m256i mag   = _mm256_set1_epi32(MATRIX_A);
+  __m256i mt0 = _mm256_loadu_si256((const __m256i *)&mt[kk]);
+  __m256i mt1 = _mm256_loadu_si256((const __m256i *)&mt[kk+1]);
+  __m256i mtm = _mm256_loadu_si256((const __m256i *)&mt[mm]);
+  __m256i y = _mm256_or_si256(
+    _mm256_and_si256(mt0, upper),
+    _mm256_and_si256(mt1, lower));
+  __m256i odd = _mm256_cmpeq_epi32(_mm256_and_si256(y, one), one);
+  __m256i r = _mm256_xor_si256(mtm, _mm256_srli_epi32(y, 1));
+  r = _mm256_xor_si256(r, _mm256_and_si256(odd, mag));
+  _mm256_storeu_si256((__m256i *)&mt[kk], r);
+}
+
+static inline void m_temper8(uint32_t *out, const uint32_t *mt) {
+  const __m256i mask_b = _mm256_set1_epi32(TEMPERING_MASK_B);
+  const __m256i mask_c = _mm256_set1_epi32(TEMPERING_MASK_C);
+  __m256i y = _mm256_loadu_si256((const __m256i *)mt);
+  y = _mm256_xor_si256(y, _mm256_srli_epi32(y, 11));
+  y = _mm256_xor_si256(y, _mm256_and_si256(_mm256_slli_epi32(y, 7), mask_b));
+  y = _mm256_xor_si256(y, _mm256_and_si256(_mm256_slli_epi32(y, 15), mask_c));
+  y = _mm256_xor_si256(y, _mm256_srli_epi32(y, 18));
+  _mm256_storeu_si256((__m256i *)out, y);
+}
+#endif
+
+/* Tempers the whole block of the state vector into the output buffer. */
+static void m_temperAll(MTRand* rand) {
+  int kk = 0;
+#ifdef __AVX2__
+  for(; kk+8<=STATE_VECTOR_LENGTH; kk+=8) {
+    m_temper8(&rand->out[kk], &rand->mt[kk]);
+  }
+#endif
+  for(; kk<STATE_VECTOR_LENGTH; kk++) {
+    rand->out[kk] = m_temper(rand->mt[kk]);
+  }
+}
+
+/**
+ * Generates next STATE_VECTOR_LENGTH words at a time. Each word depends
+ * only on words STATE_VECTOR_LENGTH-STATE_VECTOR_M positions back, so
+ * consecutive words are computed eight at a time.
+ */
+void refillRand(MTRand* rand) {
+  uint32_t *mt = rand->mt;
+  int kk = 0;
+  if(rand->keyed) {
+    m_refillKeyed(rand);
+    return;
+  }
+  if(rand->index >= STATE_VECTOR_LENGTH+1 || rand->index < 0) {
+    m_seedRand(rand, 4357);
+  }
+#ifdef __AVX2__
+  for(; kk+8<=STATE_VECTOR_LENGTH-STATE_VECTOR_M; kk+=8) {
+    m_twist8(mt, kk, kk+STATE_VECTOR_M);
+  }
+#endif
+  for(; kk<STATE_VECTOR_LENGTH-STATE_VECTOR_M; kk++) {
+    mt[kk] = m_twist(mt[kk], mt[kk+1], mt[kk+STATE_VECTOR_M]);
+  }
+#ifdef __AVX2__
+  for(; kk+8<STATE_VECTOR_LENGTH; kk+=8) {
+    m_twist8(mt, kk, kk+(STATE_VECTOR_M-STATE_VECTOR_LENGTH));
+  }
+#endif
+  for(; kk<STATE_VECTOR_LENGTH-1; kk++) {
+    mt[kk] = m_twist(mt[kk], mt[kk+1], mt[kk+(STATE_VECTOR_M-STATE_VECTOR_LENGTH)]);
+  }
+  mt[STATE_VECTOR_LENGTH-1] =
+    m_twist(mt[STATE_VECTOR_LENGTH-1], mt[0], mt[STATE_VECTOR_M-1]);
+  m_temperAll(rand);
+  rand->index = 0;
+}
+
 /**
  * Generates a pseudo-randomly generated double in the range [0..1].
  */
@@ -80,22 +172,63 @@ double genRand(MTRand* rand) {
   return((double)genRandLong(rand) / (unsigned long)0xffffffff);
 }
 
-unsigned long genRandFixed(MTRand *rand) {
-  return genRandLong(rand) & 0x7FFFFFFFul;
-}
-
 unsigned long fpoint(double x) {
   return (unsigned long)(x * 0x80000000ul);
 }
 
+/**
+ * Returns the number of failed Bernoulli trials before the next success,
+ * where p is the fixed-point probability of success. Drawing the gap is
+ * equivalent to testing genRandFixed(rand) < p for each trial, but costs
+ * one draw per success instead of one per trial.
+ */
+unsigned long genRandGap(MTRand *rand, unsigned long p) {
+  if (p == 0) {
+    return RAND_GAP_INFINITY;
+  }
+  if (p >= 0x80000000ul) {
+    return 0;
+  }
+  /* u is uniform on (0, 1] */
+  double u = ((double)genRandLong(rand) + 1.0) / 4294967296.0;
+  double gap = log(u) / log1p(-(double)p / 0x80000000ul);
+  if (gap >= (double)RAND_GAP_INFINITY) {
+    return RAND_GAP_INFINITY;
+  }
+  return (unsigned long)gap;
+}
+
 void serializeRand(FILE *file, const MTRand *rand) {
+  unsigned long mt[STATE_VECTOR_LENGTH];
+  for (int i = 0; i < STATE_VECTOR_LENGTH; ++i) {
+    mt[i] = rand->mt[i];
+  }
   serialize_tag(file, "RAND");
-  SERIALIZE_ULONG_TAB(file, rand, mt, STATE_VECTOR_LENGTH);
+  serialize_ulong_tab(file, "mt", mt, STATE_VECTOR_LENGTH);
   SERIALIZE_INT(file, rand, index);
 }
 
 void deserializeRand(FILE *file, MTRand *rand) {
+  unsigned long mt[STATE_VECTOR_LENGTH];
   deserialize_tag(file, "RAND");
-  DESERIALIZE_ULONG_TAB(file, rand, mt, STATE_VECTOR_LENGTH, 0, 0xFFFFFFFF);
+  deserialize_ulong_tab(file, "mt", mt, STATE_VECTOR_LENGTH, 0, 0xFFFFFFFF);
   DESERIALIZE_INT(file, rand, index, 0, STATE_VECTOR_LENGTH);
+  for (int i = 0; i < STATE_VECTOR_LENGTH; ++i) {
+    rand->mt[i] = mt[i];
+  }
+  rand->keyed = 0;
+  /* the block being served is not stored, but it is recomputed exactly */
+  m_temperAll(rand);
+}
+
+void scanRand(scanner_t *sc, MTRand *rand) {
+  unsigned long mt[STATE_VECTOR_LENGTH];
+  scan_tag(sc, "RAND");
+  scan_ulong_tab(sc, "mt", mt, STATE_VECTOR_LENGTH, 0, 0xFFFFFFFF);
+  SCAN_INT(sc, rand, index, 0, STATE_VECTOR_LENGTH);
+  for (int i = 0; i < STATE_VECTOR_LENGTH; ++i) {
+    rand->mt[i] = mt[i];
+  }
+  rand->keyed = 0;
+  m_temperAll(rand);
 }
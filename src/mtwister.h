@@ -1,25 +1,74 @@
 #ifndef __MTWISTER_H
 #define __MTWISTER_H
 
+#include <stdint.h>
 #include <stdio.h>
 
+struct scanner;
+
 #define STATE_VECTOR_LENGTH 624
 #define STATE_VECTOR_M      397 /* changes to STATE_VECTOR_LENGTH also require changes to this */
 
 typedef struct tagMTRand {
-  unsigned long mt[STATE_VECTOR_LENGTH];
+  uint32_t mt[STATE_VECTOR_LENGTH];  /* generator state */
+  uint32_t out[STATE_VECTOR_LENGTH]; /* tempered words of the current block */
   int index;
+  int keyed;      /* words are drawn by SplitMix64 from state, not from mt */
+  uint64_t state;
 } MTRand;
 
+/* words a keyed generator draws at a time */
+#define KEYED_BLOCK_LENGTH 16
+
 MTRand seedRand(unsigned long seed);
-unsigned long genRandLong(MTRand* rand);
+void keyRand(MTRand* rand, uint64_t key);
+void refillRand(MTRand* rand);
 double genRand(MTRand* rand);
 
+/**
+ * Generates a pseudo-randomly generated long.
+ */
+static inline unsigned long genRandLong(MTRand* rand) {
+  if (rand->index >= STATE_VECTOR_LENGTH || rand->index < 0) {
+    refillRand(rand);
+  }
+  return rand->out[rand->index++];
+}
+
+/**
+ * Generates an unbiased pseudo-random number in the range [0..n-1],
+ * where 0 < n < 2^32 (Lemire's multiply-and-shift method).
+ */
+static inline unsigned long genRandBounded(MTRand* rand, unsigned long n) {
+  uint64_t m = (uint64_t)genRandLong(rand) * n;
+  if ((uint32_t)m < n) {
+    uint32_t threshold = (uint32_t)-n % (uint32_t)n;
+    while ((uint32_t)m < threshold) {
+      m = (uint64_t)genRandLong(rand) * n;
+    }
+  }
+  return m >> 32;
+}
+
 /* fixed-point representation */
-unsigned long genRandFixed(MTRand *rand);
+static inline unsigned long genRandFixed(MTRand *rand) {
+  return genRandLong(rand) & 0x7FFFFFFFul;
+}
 unsigned long fpoint(double x);
 
+/* finalizer of SplitMix64, for hashing */
+static inline uint64_t mix64(uint64_t z) {
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+/* geometric skip sampling of rare events */
+#define RAND_GAP_INFINITY 0x7FFFFFFFFFFFFFFFul
+unsigned long genRandGap(MTRand *rand, unsigned long p);
+
 void serializeRand(FILE *file, const MTRand *rand);
 void deserializeRand(FILE *file, MTRand *rand);
+void scanRand(struct scanner *sc, MTRand *rand);
 
 #endif /* #ifndef __MTWISTER_H */
@@ -0,0 +1,197 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "persist.h"
+
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PAGE_ALIGN(x) (((x) + 4095) & ~(size_t)4095)
+#define COPY_CHUNK    (1 << 20)
+
+static void persist_map(persist_t *p, int fd) {
+  p->header = mmap(NULL, p->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p->header == MAP_FAILED) {
+    error(EXIT_FAILURE, errno, "cannot map persistent world `%s'", p->name);
+  }
+  close(fd);
+}
+
+/* Writes the header to the file, so that the data on disk are never
+ * newer than what it says about them */
+static void sync_header(persist_t *p) {
+  if (msync(p->header, PAGE_ALIGN(sizeof(persist_header_t)), MS_SYNC) != 0)
+  {
+    error(0, errno, "cannot write persistent world `%s'", p->name);
+  }
+}
+
+void persist_create(
+  persist_t *p, const settings_t *settings, size_t pop_bytes)
+{
+  p->name = settings->persist_name;
+  pop_bytes = PAGE_ALIGN(pop_bytes);
+  size_t live_offset = PAGE_ALIGN(sizeof(persist_header_t));
+  p->size = live_offset + 2 * pop_bytes;
+
+  int fd = open(p->name, O_CREAT | O_TRUNC | O_RDWR, 0644);
+  if (fd < 0) {
+    error(EXIT_FAILURE, errno, "cannot open persistent world `%s'",
+      p->name);
+  }
+  if (ftruncate(fd, p->size) != 0) {
+    error(EXIT_FAILURE, errno, "cannot resize persistent world `%s'",
+      p->name);
+  }
+  persist_map(p, fd);
+
+  persist_header_t *h = p->header;
+  h->version     = PERSIST_VERSION;
+  h->live_clean  = 0;
+  h->snap_valid  = 0;
+  h->pop_size    = settings->board_size_x * settings->board_size_y;
+  h->state_n     = settings->state_n;
+  h->pop_bytes   = pop_bytes;
+  h->live_offset = live_offset;
+  h->snap_offset = live_offset + pop_bytes;
+  memcpy(h->magic, PERSIST_MAGIC, 8);
+  p->live = (char *)h + h->live_offset;
+  p->snap = (char *)h + h->snap_offset;
+}
+
+/* Maps an existing file, checks its header and reads settings of the last
+ * checkpoint */
+void persist_open(persist_t *p, const char *name, settings_t *settings) {
+  struct stat st;
+  p->name = name;
+  int fd = open(name, O_RDWR);
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    error(EXIT_FAILURE, errno, "cannot open persistent world `%s'", name);
+  }
+  p->size = st.st_size;
+  if (p->size < sizeof(persist_header_t)) {
+    error(EXIT_FAILURE, 0, "invalid persistent world `%s'", name);
+  }
+  persist_map(p, fd);
+
+  persist_header_t *h = p->header;
+  if (memcmp(h->magic, PERSIST_MAGIC, 8) != 0
+    || h->version != PERSIST_VERSION
+    || h->live_offset != PAGE_ALIGN(sizeof(persist_header_t))
+    || h->snap_offset != h->live_offset + h->pop_bytes
+    || p->size != h->snap_offset + h->pop_bytes)
+  {
+    error(EXIT_FAILURE, 0, "invalid persistent world `%s'", name);
+  }
+  if (!h->live_clean && !h->snap_valid) {
+    error(EXIT_FAILURE, 0, "persistent world `%s' has no checkpoint", name);
+  }
+  p->live = (char *)h + h->live_offset;
+  p->snap = (char *)h + h->snap_offset;
+  p->meta = &h->meta[h->live_clean ? PERSIST_LIVE : PERSIST_SNAP];
+  if (p->meta->rand.index < 0 || p->meta->rand.index > STATE_VECTOR_LENGTH
+    || memchr(p->meta->settings, 0, PERSIST_SETTINGS_SIZE) == NULL)
+  {
+    error(EXIT_FAILURE, 0, "invalid persistent world `%s'", name);
+  }
+  if (strncmp(p->meta->trust_version, TRUST_VERSION, 16) != 0) {
+    error(EXIT_FAILURE, 0,
+      "persistent world was created by a different version of the program");
+  }
+
+  FILE *file = fmemopen((char *)p->meta->settings,
+    strlen(p->meta->settings), "r");
+  if (file == NULL) {
+    error(EXIT_FAILURE, errno, "cannot read persistent world `%s'", name);
+  }
+  settings_deserialize(file, settings);
+  fclose(file);
+  settings->persist_name = name;
+  if (h->pop_size != settings->board_size_x * settings->board_size_y
+    || h->state_n != settings->state_n)
+  {
+    error(EXIT_FAILURE, 0, "invalid persistent world `%s'", name);
+  }
+}
+
+static void copy(char *dst, const char *src, size_t size) {
+  #pragma omp parallel for schedule(dynamic)
+  for (size_t k = 0; k < size; k += COPY_CHUNK) {
+    memcpy(dst + k, src + k, (size - k < COPY_CHUNK ? size - k : COPY_CHUNK));
+  }
+}
+
+/* Brings the live population back to the last checkpoint, unless it has
+ * not changed since. */
+void persist_restore(persist_t *p, size_t pop_bytes) {
+  if (p->header->pop_bytes != PAGE_ALIGN(pop_bytes)) {
+    error(EXIT_FAILURE, 0, "invalid persistent world `%s'", p->name);
+  }
+  if (!p->header->live_clean) {
+    copy(p->live, p->snap, p->header->pop_bytes);
+  }
+}
+
+static void set_flag(persist_t *p, uint32_t *flag, uint32_t value) {
+  *flag = value;
+  sync_header(p);
+}
+
+/* Makes the live population a checkpoint, and then copies it to the
+ * snapshot, while it cannot change */
+void persist_checkpoint(
+  persist_t *p, unsigned long step, const MTRand *rand,
+  const settings_t *settings)
+{
+  persist_header_t *h    = p->header;
+  persist_meta_t   *live = &h->meta[PERSIST_LIVE];
+  persist_meta_t   *snap = &h->meta[PERSIST_SNAP];
+  FILE *file = fmemopen(live->settings, PERSIST_SETTINGS_SIZE, "w");
+  if (file == NULL) {
+    error(0, errno, "cannot write persistent world `%s'", p->name);
+    return;
+  }
+  persist_touch(p);
+  settings_serialize(file, settings);
+  long len = ftell(file);
+  fclose(file);
+  if (len < 0 || len >= PERSIST_SETTINGS_SIZE - 1) {
+    error(0, 0, "settings do not fit in persistent world `%s'", p->name);
+    return;
+  }
+  live->settings[len] = 0;
+  live->step = step;
+  live->rand = *rand;
+  strcpy(live->trust_version, TRUST_VERSION);
+  if (msync(p->live, h->pop_bytes, MS_SYNC) != 0) {
+    error(0, errno, "cannot write persistent world `%s'", p->name);
+    return;
+  }
+  set_flag(p, &h->live_clean, 1);
+
+  set_flag(p, &h->snap_valid, 0);
+  copy(p->snap, p->live, h->pop_bytes);
+  *snap = *live;
+  if (msync(p->snap, h->pop_bytes, MS_SYNC) != 0) {
+    error(0, errno, "cannot write persistent world `%s'", p->name);
+    return;
+  }
+  set_flag(p, &h->snap_valid, 1);
+}
+
+/* Called before the live population changes */
+void persist_touch(persist_t *p) {
+  if (p->header->live_clean) {
+    set_flag(p, &p->header->live_clean, 0);
+  }
+}
+
+void persist_close(persist_t *p) {
+  munmap(p->header, p->size);
+}
@@ -0,0 +1,65 @@
+#ifndef __PERSIST_H
+#define __PERSIST_H
+
+#include "mtwister.h"
+#include "settings.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PERSIST_MAGIC         "TRUSTPMW"
+#define PERSIST_VERSION       1
+#define PERSIST_SETTINGS_SIZE 65536
+
+#define PERSIST_LIVE 0
+#define PERSIST_SNAP 1
+
+/* What a copy of the population is a checkpoint of */
+typedef struct persist_meta {
+  uint64_t step;
+  MTRand   rand;
+  char     trust_version[16];
+  char     settings[PERSIST_SETTINGS_SIZE];  /* as in a world file */
+} persist_meta_t;
+
+/* A persistent world is a file mapped into memory: this header, then the
+ * live population, which the simulation uses directly, and a snapshot of
+ * it. The live population is a checkpoint while it is clean, i.e., until
+ * the next step starts, and the snapshot once it is valid. Each flag is
+ * cleared before its copy or description changes, and one of them is
+ * always set, so a crash at any moment loses only the steps since the
+ * last checkpoint. */
+typedef struct persist_header {
+  char           magic[8];
+  uint32_t       version;
+  uint32_t       live_clean;
+  uint32_t       snap_valid;
+  int32_t        pop_size;
+  int32_t        state_n;
+  uint32_t       reserved;
+  uint64_t       pop_bytes;    /* of each copy of the population */
+  uint64_t       live_offset;
+  uint64_t       snap_offset;
+  persist_meta_t meta[2];
+} persist_header_t;
+
+typedef struct persist {
+  const char           *name;
+  persist_header_t     *header;
+  size_t                size;
+  char                 *live;
+  char                 *snap;
+  const persist_meta_t *meta;  /* of the checkpoint that was opened */
+} persist_t;
+
+void persist_create(
+  persist_t *p, const settings_t *settings, size_t pop_bytes);
+void persist_open(persist_t *p, const char *name, settings_t *settings);
+void persist_restore(persist_t *p, size_t pop_bytes);
+void persist_checkpoint(
+  persist_t *p, unsigned long step, const MTRand *rand,
+  const settings_t *settings);
+void persist_touch(persist_t *p);
+void persist_close(persist_t *p);
+
+#endif
@@ -1,9 +1,16 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "serialization.h"
 
 #include <assert.h>
+#include <ctype.h>
+#include <errno.h>
 #include <error.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define FMT_BUF_SIZE 64
 
@@ -49,6 +56,16 @@ void serialize_ushort_tab(
   fprintf(file, "\n");
 }
 
+void serialize_int_tab(
+  FILE *file, const char *name, const int *data, size_t size)
+{
+  fprintf(file, "%s=", name);
+  for (size_t i = 0; i < size; ++i) {
+    fprintf(file, " %d", data[i]);
+  }
+  fprintf(file, "\n");
+}
+
 void serialize_ulong_tab(
   FILE *file, const char *name, const unsigned long *data, size_t size)
 {
@@ -155,6 +172,7 @@ void deserialize_string(FILE *file, const char *name, const char **string) {
         error(EXIT_FAILURE, 0, "invalid world file (at field %s)", name);
       }
     }
+    *string = data;
   }
 }
 
@@ -178,6 +196,25 @@ void deserialize_ushort_tab(
   }
 }
 
+void deserialize_int_tab(
+  FILE *file, const char *name, int *data, size_t size, int min, int max)
+{
+  assert(strlen(name) < FMT_BUF_SIZE - 16);
+  char fmt_buf[FMT_BUF_SIZE];
+  sprintf(fmt_buf, " %s = %%n", name);
+  int n = 0;
+  if (fscanf(file, fmt_buf, &n) != 0 || n == 0) {
+    error(EXIT_FAILURE, 0, "invalid world file (at field %s)", name);
+  }
+  for (size_t i = 0; i < size; ++i) {
+    if (fscanf(file, " %d", &data[i]) != 1
+      || data[i] < min || data[i] > max)
+    {
+      error(EXIT_FAILURE, 0, "invalid world file (at field %s)", name);
+    }
+  }
+}
+
 void deserialize_ulong_tab(
   FILE *file, const char *name, unsigned long *data, size_t size,
   unsigned long min, unsigned long max)
@@ -197,3 +234,225 @@ void deserialize_ulong_tab(
     }
   }
 }
+
+/* Maps the whole file, and starts scanning at its current position */
+void scanner_map(scanner_t *sc, FILE *file) {
+  struct stat st;
+  long        pos = ftell(file);
+  if (pos < 0 || fstat(fileno(file), &st) != 0) {
+    error(EXIT_FAILURE, errno, "cannot read world file");
+  }
+  sc->size = st.st_size;
+  sc->base = mmap(NULL, sc->size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+  if (sc->base == MAP_FAILED) {
+    error(EXIT_FAILURE, errno, "cannot map world file");
+  }
+  posix_madvise((void *)sc->base, sc->size, POSIX_MADV_SEQUENTIAL);
+  sc->pos = sc->base + pos;
+  sc->end = sc->base + sc->size;
+  sc->deferring  = 0;
+  sc->failure[0] = '\0';
+}
+
+void scanner_unmap(scanner_t *sc) {
+  munmap((void *)sc->base, sc->size);
+}
+
+void scan_defer(scanner_t *sc) {
+  sc->deferring  = 1;
+  sc->failure[0] = '\0';
+}
+
+static void scan_fail(scanner_t *sc, const char *what, const char *name) {
+  if (!sc->deferring) {
+    error(EXIT_FAILURE, 0, "invalid world file (at %s %s)", what, name);
+  }
+  if (sc->failure[0] == '\0') {
+    snprintf(sc->failure, sizeof(sc->failure), "at %s %s", what, name);
+  }
+  sc->pos = sc->end;
+}
+
+static void skip_space(scanner_t *sc) {
+  while (sc->pos < sc->end && isspace((unsigned char)*sc->pos)) {
+    sc->pos++;
+  }
+}
+
+/* Checks that only white space is left */
+int scan_done(scanner_t *sc) {
+  skip_space(sc);
+  return sc->pos == sc->end;
+}
+
+/* Finds the next tag #name, from the given place on */
+const char *scan_seek_tag(
+  const scanner_t *sc, const char *from, const char *name)
+{
+  size_t len = strlen(name);
+  while (from < sc->end) {
+    const char *p = memchr(from, '#', sc->end - from);
+    if (p == NULL) {
+      break;
+    }
+    if ((size_t)(sc->end - p) > len
+      && memcmp(p + 1, name, len) == 0
+      && (p + 1 + len == sc->end || isspace((unsigned char)p[1 + len])))
+    {
+      return p;
+    }
+    from = p + 1;
+  }
+  return NULL;
+}
+
+void scan_tag(scanner_t *sc, const char *name) {
+  size_t len = strlen(name);
+  skip_space(sc);
+  if ((size_t)(sc->end - sc->pos) <= len
+    || sc->pos[0] != '#'
+    || memcmp(sc->pos + 1, name, len) != 0
+    || (sc->pos + 1 + len < sc->end
+      && !isspace((unsigned char)sc->pos[1 + len])))
+  {
+    scan_fail(sc, "tag", name);
+    return;
+  }
+  sc->pos += 1 + len;
+}
+
+/* Reads `name =', as " name =" in scanf */
+static int scan_name(scanner_t *sc, const char *name) {
+  size_t len = strlen(name);
+  skip_space(sc);
+  if ((size_t)(sc->end - sc->pos) < len
+    || memcmp(sc->pos, name, len) != 0)
+  {
+    return 0;
+  }
+  sc->pos += len;
+  skip_space(sc);
+  if (sc->pos == sc->end || *sc->pos != '=') {
+    return 0;
+  }
+  sc->pos++;
+  return 1;
+}
+
+/* Reads a decimal number with an optional sign, after white space. Fails
+ * when it does not fit in unsigned long. */
+static int scan_number(scanner_t *sc, int *negative, unsigned long *value) {
+  skip_space(sc);
+  *negative = 0;
+  if (sc->pos < sc->end && (*sc->pos == '-' || *sc->pos == '+')) {
+    *negative = (*sc->pos == '-');
+    sc->pos++;
+  }
+  if (sc->pos == sc->end || !isdigit((unsigned char)*sc->pos)) {
+    return 0;
+  }
+  unsigned long v = 0;
+  while (sc->pos < sc->end && isdigit((unsigned char)*sc->pos)) {
+    unsigned d = *sc->pos++ - '0';
+    if (v > (ULONG_MAX - d) / 10) {
+      return 0;
+    }
+    v = v * 10 + d;
+  }
+  *value = v;
+  return 1;
+}
+
+static int scan_unsigned(
+  scanner_t *sc, unsigned long *value, unsigned long min, unsigned long max)
+{
+  int negative;
+  return scan_number(sc, &negative, value) && !negative
+    && *value >= min && *value <= max;
+}
+
+void scan_ushort(
+  scanner_t *sc, const char *name, unsigned short *value,
+  unsigned short min, unsigned short max)
+{
+  unsigned long v;
+  if (!scan_name(sc, name) || !scan_unsigned(sc, &v, min, max)) {
+    scan_fail(sc, "field", name);
+    return;
+  }
+  *value = v;
+}
+
+void scan_int(scanner_t *sc, const char *name, int *value, int min, int max)
+{
+  int           negative;
+  unsigned long v;
+  if (!scan_name(sc, name) || !scan_number(sc, &negative, &v)
+    || v > (unsigned long)INT_MAX + negative)
+  {
+    scan_fail(sc, "field", name);
+    return;
+  }
+  long x = (negative ? -(long)v : (long)v);
+  if (x < min || x > max) {
+    scan_fail(sc, "field", name);
+    return;
+  }
+  *value = x;
+}
+
+void scan_uint(
+  scanner_t *sc, const char *name, unsigned int *value,
+  unsigned int min, unsigned int max)
+{
+  unsigned long v;
+  if (!scan_name(sc, name) || !scan_unsigned(sc, &v, min, max)) {
+    scan_fail(sc, "field", name);
+    return;
+  }
+  *value = v;
+}
+
+void scan_ulong(
+  scanner_t *sc, const char *name, unsigned long *value,
+  unsigned long min, unsigned long max)
+{
+  if (!scan_name(sc, name) || !scan_unsigned(sc, value, min, max)) {
+    scan_fail(sc, "field", name);
+    return;
+  }
+}
+
+void scan_ushort_tab(
+  scanner_t *sc, const char *name, unsigned short *data, size_t size,
+  unsigned short min, unsigned short max)
+{
+  if (!scan_name(sc, name)) {
+    scan_fail(sc, "field", name);
+    return;
+  }
+  for (size_t i = 0; i < size; ++i) {
+    unsigned long v;
+    if (!scan_unsigned(sc, &v, min, max)) {
+      scan_fail(sc, "field", name);
+      return;
+    }
+    data[i] = v;
+  }
+}
+
+void scan_ulong_tab(
+  scanner_t *sc, const char *name, unsigned long *data, size_t size,
+  unsigned long min, unsigned long max)
+{
+  if (!scan_name(sc, name)) {
+    scan_fail(sc, "field", name);
+    return;
+  }
+  for (size_t i = 0; i < size; ++i) {
+    if (!scan_unsigned(sc, &data[i], min, max)) {
+      scan_fail(sc, "field", name);
+      return;
+    }
+  }
+}
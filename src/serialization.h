@@ -12,6 +12,8 @@ void serialize_ulong(FILE *file, const char *name, unsigned long value);
 void serialize_string(FILE *file, const char *name, const char *value);
 void serialize_ushort_tab(
   FILE *file, const char *name, const unsigned short *data, size_t size);
+void serialize_int_tab(
+  FILE *file, const char *name, const int *data, size_t size);
 void serialize_ulong_tab(
   FILE *file, const char *name, const unsigned long *data, size_t size);
 
@@ -32,10 +34,52 @@ void deserialize_string(FILE *file, const char *name, const char **string);
 void deserialize_ushort_tab(
   FILE *file, const char *name, unsigned short *data, size_t size,
   unsigned short min, unsigned short max);
+void deserialize_int_tab(
+  FILE *file, const char *name, int *data, size_t size, int min, int max);
 void deserialize_ulong_tab(
   FILE *file, const char *name, unsigned long *data, size_t size,
   unsigned long min, unsigned long max);
 
+/* Reads the same format from a file mapped into memory, with checks and
+ * errors of deserialize_* functions, but much faster. A scanner may be
+ * copied, and limited to a part of the file, to read parts in parallel.
+ * A deferring scanner does not exit at the first error, but keeps its
+ * message in failure and fails all later reads, so that threads can leave
+ * reporting to their caller. */
+typedef struct scanner {
+  const char *base;
+  size_t      size;
+  const char *pos;
+  const char *end;
+  int         deferring;
+  char        failure[64];  /* empty while there is no error */
+} scanner_t;
+
+void scanner_map(scanner_t *sc, FILE *file);
+void scanner_unmap(scanner_t *sc);
+const char *scan_seek_tag(
+  const scanner_t *sc, const char *from, const char *name);
+int scan_done(scanner_t *sc);
+void scan_defer(scanner_t *sc);
+
+void scan_tag(scanner_t *sc, const char *name);
+void scan_ushort(
+  scanner_t *sc, const char *name, unsigned short *value,
+  unsigned short min, unsigned short max);
+void scan_int(scanner_t *sc, const char *name, int *value, int min, int max);
+void scan_uint(
+  scanner_t *sc, const char *name, unsigned int *value,
+  unsigned int min, unsigned int max);
+void scan_ulong(
+  scanner_t *sc, const char *name, unsigned long *value,
+  unsigned long min, unsigned long max);
+void scan_ushort_tab(
+  scanner_t *sc, const char *name, unsigned short *data, size_t size,
+  unsigned short min, unsigned short max);
+void scan_ulong_tab(
+  scanner_t *sc, const char *name, unsigned long *data, size_t size,
+  unsigned long min, unsigned long max);
+
 #define SERIALIZE_USHORT(file,obj,fld) \
   serialize_ushort(file, #fld, (obj)->fld)
 #define SERIALIZE_INT(file,obj,fld) \
@@ -49,6 +93,8 @@ void deserialize_ulong_tab(
 
 #define SERIALIZE_USHORT_TAB(file,obj,fld,size) \
   serialize_ushort_tab(file, #fld, (obj)->fld, (size))
+#define SERIALIZE_INT_TAB(file,obj,fld,size) \
+  serialize_int_tab(file, #fld, (obj)->fld, (size))
 #define SERIALIZE_ULONG_TAB(file,obj,fld,size) \
   serialize_ulong_tab(file, #fld, (obj)->fld, (size))
 
@@ -65,7 +111,18 @@ void deserialize_ulong_tab(
 
 #define DESERIALIZE_USHORT_TAB(file,obj,fld,size,min,max) \
   deserialize_ushort_tab(file, #fld, (obj)->fld, (size), (min), (max))
+#define DESERIALIZE_INT_TAB(file,obj,fld,size,min,max) \
+  deserialize_int_tab(file, #fld, (obj)->fld, (size), (min), (max))
 #define DESERIALIZE_ULONG_TAB(file,obj,fld,size,min,max) \
   deserialize_ulong_tab(file, #fld, (obj)->fld, (size), (min), (max))
 
+#define SCAN_USHORT(sc,obj,fld,min,max) \
+  scan_ushort(sc, #fld, &(obj)->fld, (min), (max))
+#define SCAN_INT(sc,obj,fld,min,max) \
+  scan_int(sc, #fld, &(obj)->fld, (min), (max))
+#define SCAN_ULONG(sc,obj,fld,min,max) \
+  scan_ulong(sc, #fld, &(obj)->fld, (min), (max))
+#define SCAN_USHORT_TAB(sc,obj,fld,size,min,max) \
+  scan_ushort_tab(sc, #fld, (obj)->fld, (size), (min), (max))
+
 #endif
@@ -1,9 +1,60 @@
 #include "settings.h"
 
+#include "mtwister.h"
 #include "serialization.h"
 
 #include <ctype.h>
 #include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+void settings_default(settings_t *settings) {
+  *settings = (settings_t)
+    { .board_size_x       = DFLT_BOARD_SIZE
+    , .board_size_y       = DFLT_BOARD_SIZE
+    , .state_n            = DFLT_STATES
+    , .step_n             = DFLT_STEPS
+    , .turn_n             = DFLT_TURNS
+    , .play_area          = DFLT_PLAY_AREA
+    , .kill_area          = DFLT_KILL_AREA
+    , .cross_area         = DFLT_CROSS_AREA
+    , .lifetime           = DFLT_LIFETIME
+    , .stat_report_rate   = DFLT_STAT_REPORT_RATE
+    , .stat_flush_rate    = DFLT_STAT_FLUSH_RATE
+    , .example_rate       = DFLT_EXAMPLE_RATE
+    , .image_rate         = DFLT_IMAGE_RATE
+    , .backup_rate        = DFLT_BACKUP_RATE
+    , .flags              = 0
+    , .topology           = TOPOLOGY_TORUS
+    , .attach_n           = DFLT_ATTACH_N
+    , .payoff             = DFLT_PAYOFF
+    , .steady_window      = 0
+    , .steady_policy      = STEADY_STOP
+    , .keyframe_rate      = DFLT_KEYFRAME_RATE
+    , .png_level          = DFLT_PNG_LEVEL
+    , .png_filter         = PNG_FILTER_ADAPTIVE
+    , .seed               = DFLT_SEED
+    , .mistake_rate       = fpoint(DFLT_MISTAKE_RATE)
+    , .cross_rate         = fpoint(DFLT_CROSS_RATE)
+    , .state_mut_rate     = fpoint(DFLT_STATE_MUT_RATE)
+    , .action_mut_rate    = fpoint(DFLT_ACTION_MUT_RATE)
+    , .edge_mut_rate      = fpoint(DFLT_EDGE_MUT_RATE)
+    , .rewire_rate        = fpoint(DFLT_REWIRE_RATE)
+    , .steady_tolerance   = fpoint(DFLT_STEADY_TOLERANCE)
+    , .transcript_rate    = fpoint(DFLT_TRANSCRIPT_RATE)
+    , .stat_file          = DFLT_STAT_FILE
+    , .example_name       = DFLT_EXAMPLE_NAME
+    , .image_name         = DFLT_IMAGE_NAME
+    , .graph_file         = NULL
+    , .lineage_name       = NULL
+    , .history_name       = NULL
+    , .live_name          = NULL
+    , .transcript_name    = NULL
+    , .transcript_cells   = NULL
+    , .tiles_name         = NULL
+    , .persist_name       = NULL
+    };
+}
 
 static int parse_num_nc(const char *str, int *num, int min, int max) {
   int n = 0;
@@ -62,6 +113,54 @@ parse_size_result_t parse_size(const char *str, settings_t *settings) {
     PARSE_SIZE_TOO_SMALL : PARSE_SIZE_OK;
 }
 
+static const struct {
+  const char *name;
+  int         payoff[4];
+} known_payoffs[] = {
+  /*                   P   T   S   R */
+    { "prisoner",  { 0,  3, -1,  2 } }
+  , { "snowdrift", { 0,  3,  1,  2 } }
+  , { "stag-hunt", { 0,  2, -1,  3 } }
+  , { "harmony",   { 0,  2,  1,  3 } }
+  };
+
+/* Accepts either a name of a known game, or four numbers "R,S,T,P" */
+int parse_payoff(const char *str, settings_t *settings) {
+  for (size_t k = 0; k < sizeof(known_payoffs)/sizeof(*known_payoffs); k++) {
+    if (strcmp(str, known_payoffs[k].name) == 0) {
+      memcpy(settings->payoff, known_payoffs[k].payoff,
+        sizeof(settings->payoff));
+      return CHECK_OK;
+    }
+  }
+  static const int order[4] = { PAYOFF_R, PAYOFF_S, PAYOFF_T, PAYOFF_P };
+  int payoff[4];
+  for (int k = 0; k < 4; k++) {
+    char *end;
+    long value = strtol(str, &end, 10);
+    if (end == str || value < -MAX_PAYOFF || value > MAX_PAYOFF
+      || *end != (k < 3 ? ',' : 0))
+    {
+      return CHECK_FAIL;
+    }
+    payoff[order[k]] = value;
+    str = end + 1;
+  }
+  memcpy(settings->payoff, payoff, sizeof(payoff));
+  return CHECK_OK;
+}
+
+/* The difference between the best and the worst payoff, at least 1 */
+int payoff_span(const settings_t *settings) {
+  int min = settings->payoff[0];
+  int max = settings->payoff[0];
+  for (int k = 1; k < 4; k++) {
+    if (settings->payoff[k] < min) min = settings->payoff[k];
+    if (settings->payoff[k] > max) max = settings->payoff[k];
+  }
+  return (max > min ? max - min : 1);
+}
+
 void settings_serialize(FILE *file, const settings_t *settings) {
   serialize_tag(file, "SETTINGS");
   SERIALIZE_INT(file, settings, board_size_x);
@@ -79,15 +178,34 @@ void settings_serialize(FILE *file, const settings_t *settings) {
   SERIALIZE_INT(file, settings, image_rate);
   SERIALIZE_INT(file, settings, backup_rate);
   SERIALIZE_INT(file, settings, flags);
+  SERIALIZE_INT(file, settings, topology);
+  SERIALIZE_INT(file, settings, attach_n);
+  SERIALIZE_INT_TAB(file, settings, payoff, 4);
+  SERIALIZE_INT(file, settings, steady_window);
+  SERIALIZE_INT(file, settings, steady_policy);
+  SERIALIZE_INT(file, settings, keyframe_rate);
+  SERIALIZE_INT(file, settings, png_level);
+  SERIALIZE_INT(file, settings, png_filter);
   SERIALIZE_ULONG(file, settings, seed);
   SERIALIZE_ULONG(file, settings, mistake_rate);
   SERIALIZE_ULONG(file, settings, cross_rate);
   SERIALIZE_ULONG(file, settings, state_mut_rate);
   SERIALIZE_ULONG(file, settings, action_mut_rate);
   SERIALIZE_ULONG(file, settings, edge_mut_rate);
+  SERIALIZE_ULONG(file, settings, rewire_rate);
+  SERIALIZE_ULONG(file, settings, steady_tolerance);
+  SERIALIZE_ULONG(file, settings, transcript_rate);
   SERIALIZE_STRING(file, settings, stat_file);
   SERIALIZE_STRING(file, settings, example_name);
   SERIALIZE_STRING(file, settings, image_name);
+  SERIALIZE_STRING(file, settings, graph_file);
+  SERIALIZE_STRING(file, settings, lineage_name);
+  SERIALIZE_STRING(file, settings, history_name);
+  SERIALIZE_STRING(file, settings, live_name);
+  SERIALIZE_STRING(file, settings, transcript_name);
+  SERIALIZE_STRING(file, settings, transcript_cells);
+  SERIALIZE_STRING(file, settings, tiles_name);
+  SERIALIZE_STRING(file, settings, persist_name);
 }
 
 void settings_deserialize(FILE *file, settings_t *settings) {
@@ -107,13 +225,34 @@ void settings_deserialize(FILE *file, settings_t *settings) {
   DESERIALIZE_INT(file, settings, image_rate, 1, MAX_REPORT_RATE);
   DESERIALIZE_INT(file, settings, backup_rate, 1, MAX_REPORT_RATE);
   DESERIALIZE_INT(file, settings, flags, 0, INT_MAX);
+  DESERIALIZE_INT(file, settings, topology, TOPOLOGY_TORUS, TOPOLOGY_FILE);
+  DESERIALIZE_INT(file, settings, attach_n, 1, MAX_ATTACH_N);
+  DESERIALIZE_INT_TAB(file, settings, payoff, 4, -MAX_PAYOFF, MAX_PAYOFF);
+  DESERIALIZE_INT(file, settings, steady_window, 0, MAX_STEADY_WIN);
+  DESERIALIZE_INT(file, settings, steady_policy, STEADY_STOP,
+    STEADY_THROTTLE);
+  DESERIALIZE_INT(file, settings, keyframe_rate, 1, MAX_REPORT_RATE);
+  DESERIALIZE_INT(file, settings, png_level, 0, MAX_PNG_LEVEL);
+  DESERIALIZE_INT(file, settings, png_filter, PNG_FILTER_NONE,
+    PNG_FILTER_ADAPTIVE);
   DESERIALIZE_ULONG(file, settings, seed, 0, ULONG_MAX);
   DESERIALIZE_ULONG(file, settings, mistake_rate, 0, ULONG_MAX);
   DESERIALIZE_ULONG(file, settings, cross_rate, 0, ULONG_MAX);
   DESERIALIZE_ULONG(file, settings, state_mut_rate, 0, ULONG_MAX);
   DESERIALIZE_ULONG(file, settings, action_mut_rate, 0, ULONG_MAX);
   DESERIALIZE_ULONG(file, settings, edge_mut_rate, 0, ULONG_MAX);
+  DESERIALIZE_ULONG(file, settings, rewire_rate, 0, ULONG_MAX);
+  DESERIALIZE_ULONG(file, settings, steady_tolerance, 0, ULONG_MAX);
+  DESERIALIZE_ULONG(file, settings, transcript_rate, 0, ULONG_MAX);
   DESERIALIZE_STRING(file, settings, stat_file);
   DESERIALIZE_STRING(file, settings, example_name);
   DESERIALIZE_STRING(file, settings, image_name);
+  DESERIALIZE_STRING(file, settings, graph_file);
+  DESERIALIZE_STRING(file, settings, lineage_name);
+  DESERIALIZE_STRING(file, settings, history_name);
+  DESERIALIZE_STRING(file, settings, live_name);
+  DESERIALIZE_STRING(file, settings, transcript_name);
+  DESERIALIZE_STRING(file, settings, transcript_cells);
+  DESERIALIZE_STRING(file, settings, tiles_name);
+  DESERIALIZE_STRING(file, settings, persist_name);
 }
@@ -3,7 +3,7 @@
 
 #include <stdio.h>
 
-#define TRUST_VERSION "1.0.0"
+#define TRUST_VERSION "1.10.3"
 
 #define MAX_BOARD_SIZE  4096
 #define MAX_AREA_SIZE   2048
@@ -12,6 +12,40 @@
 #define MAX_TURN_N      1000000
 #define MAX_LIFETIME    10000
 #define MAX_REPORT_RATE 1000000
+#define MAX_ATTACH_N    1000
+#define MAX_PAYOFF      1000
+#define MAX_STEADY_WIN  1000000
+#define MAX_PNG_LEVEL   9
+
+#define DFLT_BOARD_SIZE          32
+#define DFLT_STATES              32
+#define DFLT_STEPS               0
+#define DFLT_TURNS               16
+#define DFLT_PLAY_AREA           3
+#define DFLT_KILL_AREA           2
+#define DFLT_CROSS_AREA          4
+#define DFLT_LIFETIME            2000
+#define DFLT_STAT_REPORT_RATE    1
+#define DFLT_STAT_FLUSH_RATE     10
+#define DFLT_EXAMPLE_RATE        200
+#define DFLT_IMAGE_RATE          10
+#define DFLT_BACKUP_RATE         1000
+#define DFLT_KEYFRAME_RATE       1000
+#define DFLT_SEED                1337
+#define DFLT_MISTAKE_RATE        0.0
+#define DFLT_CROSS_RATE          0.0
+#define DFLT_STATE_MUT_RATE      0.01
+#define DFLT_ACTION_MUT_RATE     0.01
+#define DFLT_EDGE_MUT_RATE       0.01
+#define DFLT_REWIRE_RATE         0.05
+#define DFLT_ATTACH_N            3
+#define DFLT_STEADY_TOLERANCE    0.01
+#define DFLT_STAT_FILE           NULL
+#define DFLT_EXAMPLE_NAME        NULL
+#define DFLT_IMAGE_NAME          NULL
+#define DFLT_TRANSCRIPT_RATE     0.001
+#define DFLT_PNG_LEVEL           6
+#define DFLT_PAYOFF              { 0, 3, -1, 2 }  /* prisoner's dilemma */
 
 #define CHECK_OK   0
 #define CHECK_FAIL 1
@@ -22,6 +56,36 @@
 #define F_DETERMINISTIC    0x10
 #define F_MISTAKE_AWARE    0x20
 #define F_DECISION_AWARE   0x40
+#define F_LAYOUT_MORTON    0x100
+#define F_LAYOUT_HILBERT   0x200
+#define F_SPECIES_BEHAVE   0x400
+
+#define TOPOLOGY_TORUS       0
+#define TOPOLOGY_VON_NEUMANN 1
+#define TOPOLOGY_HEX         2
+#define TOPOLOGY_SMALL_WORLD 3
+#define TOPOLOGY_SCALE_FREE  4
+#define TOPOLOGY_FILE        5
+
+/* PNG filter types; the adaptive one picks the best for each row */
+#define PNG_FILTER_NONE     0
+#define PNG_FILTER_SUB      1
+#define PNG_FILTER_UP       2
+#define PNG_FILTER_AVG      3
+#define PNG_FILTER_PAETH    4
+#define PNG_FILTER_ADAPTIVE 5
+
+#define STEADY_STOP     0
+#define STEADY_BACKUP   1
+#define STEADY_THROTTLE 2
+
+/* payoff[PAYOFF(own, other)] is the score of a player, given own action and
+ * the action of the opponent (1 means cooperation, 0 means defection) */
+#define PAYOFF(own, other) ((own) << 1 | (other))
+#define PAYOFF_P PAYOFF(0, 0)
+#define PAYOFF_T PAYOFF(0, 1)
+#define PAYOFF_S PAYOFF(1, 0)
+#define PAYOFF_R PAYOFF(1, 1)
 
 typedef struct settings {
   int           board_size_x;
@@ -39,17 +103,38 @@ typedef struct settings {
   int           image_rate;
   int           backup_rate;
   int           flags;
+  int           topology;
+  int           attach_n;
+  int           payoff[4];
+  int           steady_window;
+  int           steady_policy;
+  int           keyframe_rate;
+  int           png_level;
+  int           png_filter;
   unsigned long seed;
   unsigned long mistake_rate;
   unsigned long cross_rate;
   unsigned long state_mut_rate;
   unsigned long action_mut_rate;
   unsigned long edge_mut_rate;
+  unsigned long rewire_rate;
+  unsigned long steady_tolerance;
+  unsigned long transcript_rate;
   const char   *stat_file;
   const char   *example_name;
   const char   *image_name;
+  const char   *graph_file;
+  const char   *lineage_name;
+  const char   *history_name;
+  const char   *live_name;
+  const char   *transcript_name;
+  const char   *transcript_cells;
+  const char   *tiles_name;
+  const char   *persist_name;
 } settings_t;
 
+void settings_default(settings_t *settings);
+
 int parse_number(const char *str, int *num, int min, int max);
 
 typedef enum parse_size_result {
@@ -60,6 +145,8 @@ typedef enum parse_size_result {
 } parse_size_result_t;
 
 parse_size_result_t parse_size(const char *str, settings_t *settings);
+int parse_payoff(const char *str, settings_t *settings);
+int payoff_span(const settings_t *settings);
 
 void settings_serialize(FILE *file, const settings_t *settings);
 void settings_deserialize(FILE *file, settings_t *settings);
@@ -0,0 +1,131 @@
+#include <argp.h>
+#include <errno.h>
+#include <error.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "settings.h"
+#include "transcript.h"
+
+/* ========================================================================= */
+/* Argument parsing */
+
+const char *argp_program_version = "trust-transcript " TRUST_VERSION;
+static const char doc[] =
+  "Prints games recorded by trust --transcript.\v"
+  "Each game is shown with the step, cells and ids of both players, and "
+  "their scores, followed by its turns: the state of each player and its "
+  "move, C (cooperation) or D (defection). A mistake is shown as the "
+  "decision, an arrow and the effective action, e.g., C>D.";
+
+static const char args_doc[] = "FILE";
+
+#define OPT_CELL    'c'
+#define OPT_SUMMARY 's'
+
+static struct argp_option options[] =
+  { { "cell", OPT_CELL, "CELL", 0,
+      "Show only games of the automaton in CELL" }
+  , { "summary", OPT_SUMMARY, 0, 0,
+      "Show games without their turns" }
+  , { 0 }
+  };
+
+typedef struct options {
+  const char *file;
+  long        cell;
+  int         summary;
+} options_t;
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state) {
+  options_t *opts = state->input;
+  switch (key) {
+  case OPT_CELL:
+    opts->cell = atol(arg);
+    break;
+  case OPT_SUMMARY:
+    opts->summary = 1;
+    break;
+  case ARGP_KEY_ARG:
+    if (opts->file != NULL) {
+      argp_usage(state);
+    }
+    opts->file = arg;
+    break;
+  case ARGP_KEY_END:
+    if (opts->file == NULL) {
+      argp_usage(state);
+    }
+    break;
+  default:
+    return ARGP_ERR_UNKNOWN;
+  }
+  return 0;
+}
+
+static struct argp argp = { options, parse_opt, args_doc, doc, 0, 0, 0 };
+
+/* ========================================================================= */
+
+static const char *move_name(int move) {
+  static const char *names[8] =
+    { "D", "C", "D>C", "C>D", "D", "C", "D>C", "C>D" };
+  return names[move & (TRANSCRIPT_DECISION | TRANSCRIPT_MISTAKE)];
+}
+
+int main(int argc, char **argv) {
+  options_t opts = { .file = NULL, .cell = -1, .summary = 0 };
+  argp_parse(&argp, argc, argv, 0, 0, &opts);
+
+  FILE *file = fopen(opts.file, "rb");
+  if (file == NULL) {
+    error(EXIT_FAILURE, errno, "cannot open file `%s'", opts.file);
+  }
+  char     magic[8];
+  uint32_t head[3];
+  if (fread(magic, 1, 8, file) != 8 || memcmp(magic, TRANSCRIPT_MAGIC, 8)
+    || fread(head, sizeof(uint32_t), 3, file) != 3)
+  {
+    error(EXIT_FAILURE, 0, "`%s' is not a transcript", opts.file);
+  }
+  if (head[0] != TRANSCRIPT_VERSION || head[1] != sizeof(transcript_game_t)
+    || head[2] != sizeof(transcript_turn_t))
+  {
+    error(EXIT_FAILURE, 0, "unsupported version of transcript `%s'",
+      opts.file);
+  }
+
+  transcript_game_t  game;
+  transcript_turn_t *turns = NULL;
+  while (fread(&game, sizeof(game), 1, file) == 1) {
+    turns = realloc(turns, sizeof(transcript_turn_t) * game.turn_n);
+    if (fread(turns, sizeof(transcript_turn_t), game.turn_n, file)
+      != game.turn_n)
+    {
+      error(EXIT_FAILURE, 0, "truncated transcript `%s'", opts.file);
+    }
+    if (opts.cell >= 0 && game.cell[0] != opts.cell
+      && game.cell[1] != opts.cell)
+    {
+      continue;
+    }
+    printf("step %lu: cell %u (id %lu) vs cell %u (id %lu), "
+      "scores %d and %d\n",
+      (unsigned long)game.step,
+      game.cell[0], (unsigned long)game.id[0],
+      game.cell[1], (unsigned long)game.id[1],
+      game.score[0], game.score[1]);
+    if (opts.summary) {
+      continue;
+    }
+    for (uint32_t t = 0; t < game.turn_n; ++t) {
+      printf("  %6u: %5u %-3s  %5u %s\n", t,
+        turns[t].state[0], move_name(turns[t].move[0]),
+        turns[t].state[1], move_name(turns[t].move[1]));
+    }
+  }
+  free(turns);
+  fclose(file);
+  return 0;
+}
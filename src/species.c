@@ -0,0 +1,213 @@
+#include "species.h"
+
+#include "mtwister.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define PROBE_N   16
+#define PROBE_LEN 16
+#define PROBE_WORDS (PROBE_N * PROBE_LEN / 64)
+
+typedef struct sig {
+  uint64_t hash;
+  int      st;
+} sig_t;
+
+static int cmp_sig(const void *a, const void *b) {
+  const sig_t *x = a;
+  const sig_t *y = b;
+  if (x->hash != y->hash) {
+    return x->hash < y->hash ? -1 : 1;
+  }
+  return x->st - y->st;
+}
+
+/* Numbers blocks by distinct signatures, and returns their number */
+static int assign_blocks(sig_t *sig, int n, int *block) {
+  qsort(sig, n, sizeof(sig_t), cmp_sig);
+  int blocks = 0;
+  for (int k = 0; k < n; ++k) {
+    if (k > 0 && sig[k].hash != sig[k-1].hash) {
+      blocks++;
+    }
+    block[sig[k].st] = blocks;
+  }
+  return blocks + 1;
+}
+
+/* Moore's partition refinement: states stay together, as long as they
+ * have equal actions and their successors are in equal blocks */
+static void minimise(const state_t *st, int n, int *block, sig_t *sig) {
+  for (int k = 0; k < n; ++k) {
+    sig[k].hash = st[k].action;
+    sig[k].st   = k;
+  }
+  int blocks = assign_blocks(sig, n, block);
+  while (1) {
+    for (int k = 0; k < n; ++k) {
+      uint64_t h = mix64(block[k]);
+      for (int e = 0; e < 8; ++e) {
+        h = mix64(h ^ block[st[k].next_tab[e]]);
+      }
+      sig[k].hash = h;
+      sig[k].st   = k;
+    }
+    int refined = assign_blocks(sig, n, block);
+    if (refined == blocks) {
+      return;
+    }
+    blocks = refined;
+  }
+}
+
+/* FNV-1a hash of the minimal automaton, with blocks numbered in order of
+ * discovery from the initial state */
+static uint64_t minimal_hash(const state_t *st, int n, const int *block) {
+  int *canon = malloc(sizeof(int) * n);
+  int *queue = malloc(sizeof(int) * n);
+  for (int k = 0; k < n; ++k) {
+    canon[k] = -1;
+  }
+  int head = 0;
+  int tail = 0;
+  canon[block[0]] = tail;
+  queue[tail++]   = 0;
+  uint64_t h = 0xcbf29ce484222325ull;
+  while (head < tail) {
+    const state_t *s = &st[queue[head++]];
+    h = (h ^ s->action) * 0x100000001b3ull;
+    for (int e = 0; e < 8; ++e) {
+      int next = s->next_tab[e];
+      if (canon[block[next]] < 0) {
+        canon[block[next]] = tail;
+        queue[tail++]      = next;
+      }
+      h = (h ^ canon[block[next]]) * 0x100000001b3ull;
+    }
+  }
+  free(canon);
+  free(queue);
+  /* 0 marks empty slots of species counts */
+  return h ? h : 1;
+}
+
+/* Answers (most likely decisions) of the automaton to fixed sequences of
+ * moves of the opponent form a vector of bits. Each bit of the SimHash
+ * tells on which side of a fixed random hyperplane the vector lies. */
+static uint64_t probe_simhash(const state_t *st) {
+  uint64_t answer[PROBE_WORDS] = { 0 };
+  for (int p = 0; p < PROBE_N; ++p) {
+    uint64_t moves = mix64(p + 1);
+    int s = 0;
+    for (int t = 0; t < PROBE_LEN; ++t) {
+      int dec = (2 * st[s].action >= ACTION_RESOLUTION);
+      int opp = (moves >> t) & 1;
+      int bit = p * PROBE_LEN + t;
+      answer[bit / 64] |= (uint64_t)dec << (bit % 64);
+      s = st[s].next[0][dec][opp];
+    }
+  }
+  uint64_t simhash = 0;
+  for (int b = 0; b < 64; ++b) {
+    int dist = 0;
+    for (int w = 0; w < PROBE_WORDS; ++w) {
+      dist += __builtin_popcountll(answer[w] ^ mix64(b * PROBE_WORDS + w));
+    }
+    simhash |= (uint64_t)(2 * dist < 64 * PROBE_WORDS) << b;
+  }
+  return simhash;
+}
+
+/* Identifies the species of the automaton with the given play table of n
+ * states. Edges never taken are redirected first, so that they do not
+ * tell automata apart. */
+void species_identify(
+  const state_t    *play,
+  int               n,
+  const settings_t *settings,
+  uint64_t         *species,
+  uint64_t         *simhash)
+{
+  state_t *st    = malloc(sizeof(state_t) * n);
+  int     *block = malloc(sizeof(int) * n);
+  sig_t   *sig   = malloc(sizeof(sig_t) * n);
+  memcpy(st, play, sizeof(state_t) * n);
+  automaton_canonicalise(st, n, settings);
+  minimise(st, n, block, sig);
+  *species = minimal_hash(st, n, block);
+  *simhash = probe_simhash(st);
+  free(st);
+  free(block);
+  free(sig);
+}
+
+/* Each channel counts set bits in a third of the SimHash, so that species
+ * which behave almost alike get similar colours */
+unsigned species_color(uint64_t simhash) {
+  unsigned color = 0;
+  for (int c = 0; c < 3; ++c) {
+    int bits = __builtin_popcountll((simhash >> (21 * c)) & 0x1FFFFF);
+    int v    = 128 + (2 * bits - 21) * 12;
+    v = (v < 0 ? 0 : v > 255 ? 255 : v);
+    color |= (unsigned)v << (8 * c);
+  }
+  return color;
+}
+
+void species_count_init(species_count_t *sc, int size) {
+  int cap = 16;
+  while (cap < 2 * size) {
+    cap *= 2;
+  }
+  sc->mask  = cap - 1;
+  sc->n     = 0;
+  sc->key   = calloc(cap, sizeof(uint64_t));
+  sc->count = calloc(cap, sizeof(int));
+}
+
+void species_count_destroy(species_count_t *sc) {
+  free(sc->key);
+  free(sc->count);
+}
+
+/* Linear probing; emptied slots are filled by shifting later entries of
+ * the same run back, so no tombstones are needed. The table holds at
+ * most as many species as automata, so it is never more than half full.
+ * Returns the new count of the species. */
+int species_count_add(species_count_t *sc, uint64_t species, int delta) {
+  int k = mix64(species) & sc->mask;
+  while (sc->key[k] != 0 && sc->key[k] != species) {
+    k = (k + 1) & sc->mask;
+  }
+  if (sc->key[k] == 0) {
+    sc->key[k] = species;
+    sc->n++;
+  }
+  sc->count[k] += delta;
+  if (sc->count[k] > 0) {
+    return sc->count[k];
+  }
+  sc->n--;
+  int hole = k;
+  while (1) {
+    sc->key[hole]   = 0;
+    sc->count[hole] = 0;
+    int j = hole;
+    while (1) {
+      j = (j + 1) & sc->mask;
+      if (sc->key[j] == 0) {
+        return 0;
+      }
+      int home = mix64(sc->key[j]) & sc->mask;
+      /* the entry at j may move to the hole, unless its home lies
+       * cyclically in (hole, j] */
+      if (((j - home) & sc->mask) >= ((j - hole) & sc->mask)) {
+        break;
+      }
+    }
+    sc->key[hole]   = sc->key[j];
+    sc->count[hole] = sc->count[j];
+    hole = j;
+  }
+}
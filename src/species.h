@@ -0,0 +1,35 @@
+#ifndef __SPECIES_H
+#define __SPECIES_H
+
+#include "automaton.h"
+#include "settings.h"
+
+#include <stdint.h>
+
+/* Automata are of the same species, when they behave the same in every
+ * game: their minimal automata are equal. Species get a hash of the
+ * minimal automaton, and a SimHash of answers to fixed probe games,
+ * which differs in a few bits for automata that behave almost alike. */
+void species_identify(
+  const state_t    *play,
+  int               n,
+  const settings_t *settings,
+  uint64_t         *species,
+  uint64_t         *simhash);
+
+unsigned species_color(uint64_t simhash);
+
+/* Numbers of automata of each species present, in an open addressing
+ * hash table */
+typedef struct species_count {
+  int       mask;
+  int       n;       /* number of species present */
+  uint64_t *key;     /* 0 for empty slots */
+  int      *count;
+} species_count_t;
+
+void species_count_init(species_count_t *sc, int size);
+void species_count_destroy(species_count_t *sc);
+int species_count_add(species_count_t *sc, uint64_t species, int delta);
+
+#endif
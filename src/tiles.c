@@ -0,0 +1,289 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "tiles.h"
+
+#include "mtwister.h"
+#include "world.h"
+#include "world_image.h"
+
+#include <errno.h>
+#include <error.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static const char *layer_names[2] = { "score", "species" };
+
+static void make_dir(const char *path) {
+  if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+    error(EXIT_FAILURE, errno, "cannot create directory `%s'", path);
+  }
+}
+
+void tiles_open(tiles_t *tiles, const settings_t *settings) {
+  tiles->dir     = settings->tiles_name;
+  tiles->size_x  = settings->board_size_x;
+  tiles->size_y  = settings->board_size_y;
+  tiles->layer_n = (settings->flags & F_SPECIES_MAP ? 2 : 1);
+  tiles->fresh   = 1;
+
+  int level_n = 1;
+  while ((((tiles->size_x - 1) >> (level_n - 1)) + 1) > TILE_SIZE
+    || (((tiles->size_y - 1) >> (level_n - 1)) + 1) > TILE_SIZE)
+  {
+    level_n++;
+  }
+  tiles->level_n = level_n;
+  tiles->tile_x  = malloc(sizeof(int) * level_n);
+  tiles->tile_y  = malloc(sizeof(int) * level_n);
+  tiles->pixels  = malloc(sizeof(uint8_t *) * level_n * tiles->layer_n);
+  tiles->changed = malloc(sizeof(uint8_t *) * level_n * tiles->layer_n);
+  for (int k = 0; k < level_n; ++k) {
+    int w = ((tiles->size_x - 1) >> k) + 1;
+    int h = ((tiles->size_y - 1) >> k) + 1;
+    tiles->tile_x[k] = (w + TILE_SIZE - 1) / TILE_SIZE;
+    tiles->tile_y[k] = (h + TILE_SIZE - 1) / TILE_SIZE;
+    for (int l = 0; l < tiles->layer_n; ++l) {
+      tiles->pixels[l * level_n + k] =
+        (k == 0 ? NULL : malloc((size_t)3 * w * h));
+      tiles->changed[l * level_n + k] =
+        malloc(tiles->tile_x[k] * tiles->tile_y[k]);
+    }
+  }
+  for (int l = 0; l < tiles->layer_n; ++l) {
+    tiles->hash[l] = calloc(tiles->tile_x[0] * tiles->tile_y[0],
+      sizeof(uint64_t));
+  }
+
+  char *path = malloc(strlen(tiles->dir) + 64);
+  make_dir(tiles->dir);
+  for (int l = 0; l < tiles->layer_n; ++l) {
+    sprintf(path, "%s/%s", tiles->dir, layer_names[l]);
+    make_dir(path);
+    for (int z = 0; z < level_n; ++z) {
+      sprintf(path, "%s/%s/%d", tiles->dir, layer_names[l], z);
+      make_dir(path);
+    }
+  }
+  free(path);
+}
+
+void tiles_close(tiles_t *tiles) {
+  for (int i = 0; i < tiles->level_n * tiles->layer_n; ++i) {
+    free(tiles->pixels[i]);
+    free(tiles->changed[i]);
+  }
+  for (int l = 0; l < tiles->layer_n; ++l) {
+    free(tiles->hash[l]);
+  }
+  free(tiles->pixels);
+  free(tiles->changed);
+  free(tiles->tile_x);
+  free(tiles->tile_y);
+}
+
+typedef struct region {
+  const uint8_t *pixels;
+  size_t         stride;
+  size_t         row_bytes;
+} region_t;
+
+static void region_row(const void *data, int y, uint8_t *row) {
+  const region_t *r = data;
+  memcpy(row, r->pixels + y * r->stride, r->row_bytes);
+}
+
+static uint64_t hash_pixels(const uint8_t *pixels, size_t n) {
+  uint64_t h = n;
+  size_t   k = 0;
+  for (; k + 8 <= n; k += 8) {
+    uint64_t w;
+    memcpy(&w, pixels + k, 8);
+    h = mix64(h ^ w);
+  }
+  for (; k < n; ++k) {
+    h = mix64(h ^ pixels[k]);
+  }
+  return h;
+}
+
+/* Averages pixels of a w x h region into the next level */
+static void downsample(
+  const uint8_t *src, size_t src_stride, int w, int h,
+  uint8_t *dst, size_t dst_stride)
+{
+  for (int y = 0; y < (h + 1) / 2; ++y) {
+    for (int x = 0; x < (w + 1) / 2; ++x) {
+      int sum[3] = { 0, 0, 0 };
+      int cnt    = 0;
+      for (int dy = 0; dy < 2 && 2*y + dy < h; ++dy) {
+        for (int dx = 0; dx < 2 && 2*x + dx < w; ++dx) {
+          const uint8_t *p = src + (2*y + dy) * src_stride + (2*x + dx) * 3;
+          sum[0] += p[0];
+          sum[1] += p[1];
+          sum[2] += p[2];
+          cnt++;
+        }
+      }
+      for (int c = 0; c < 3; ++c) {
+        dst[y * dst_stride + x * 3 + c] = (sum[c] + cnt / 2) / cnt;
+      }
+    }
+  }
+}
+
+/* Writes the tile under a temporary name first, so that viewers never see
+ * it half-written */
+static void write_tile(
+  const tiles_t *tiles, const world_t *world, int layer, int k, int tx,
+  int ty, const region_t *r, int w, int h)
+{
+  char title[64];
+  char *fname = malloc(strlen(tiles->dir) + 96);
+  char *tmp   = malloc(strlen(tiles->dir) + 96);
+  sprintf(fname, "%s/%s/%d/%d_%d.png", tiles->dir, layer_names[layer],
+    tiles->level_n - 1 - k, tx, ty);
+  sprintf(tmp, "%s.tmp", fname);
+  sprintf(title, "Step %lu", world->step);
+  if (write_png(tmp, w, h, title, &world->settings, region_row, r)
+      == CHECK_OK
+    && rename(tmp, fname) != 0)
+  {
+    error(0, errno, "cannot rename file `%s'", tmp);
+  }
+  free(fname);
+  free(tmp);
+}
+
+static void tile_bounds(
+  const tiles_t *tiles, int k, int t, int *tx, int *ty, int *w, int *h)
+{
+  int size_x = ((tiles->size_x - 1) >> k) + 1;
+  int size_y = ((tiles->size_y - 1) >> k) + 1;
+  *tx = t % tiles->tile_x[k];
+  *ty = t / tiles->tile_x[k];
+  *w  = size_x - *tx * TILE_SIZE;
+  *h  = size_y - *ty * TILE_SIZE;
+  if (*w > TILE_SIZE) *w = TILE_SIZE;
+  if (*h > TILE_SIZE) *h = TILE_SIZE;
+}
+
+/* Draws the tiles of level 0, and writes the changed ones */
+static void write_base(tiles_t *tiles, const world_t *world, int layer) {
+  int      level_n = tiles->level_n;
+  int      tile_n  = tiles->tile_x[0] * tiles->tile_y[0];
+  long     unit    = image_score_unit(world);
+  uint8_t *changed = tiles->changed[layer * level_n];
+  uint8_t *next    = (level_n > 1 ? tiles->pixels[layer * level_n + 1]
+                                  : NULL);
+  size_t   next_stride = (size_t)3 * (((tiles->size_x - 1) >> 1) + 1);
+  #pragma omp parallel for schedule(dynamic)
+  for (int t = 0; t < tile_n; ++t) {
+    int tx, ty, w, h;
+    tile_bounds(tiles, 0, t, &tx, &ty, &w, &h);
+    uint8_t *buf = malloc((size_t)3 * w * h);
+    for (int y = 0; y < h; ++y) {
+      for (int x = 0; x < w; ++x) {
+        int i = (ty * TILE_SIZE + y) * tiles->size_x + tx * TILE_SIZE + x;
+        uint8_t *p = &buf[(y * w + x) * 3];
+        if (layer == TILE_LAYER_SCORE) {
+          image_score_rgb(p, unit, world->pop.score[i]);
+        } else {
+          image_species_rgb(p, world, i);
+        }
+      }
+    }
+    uint64_t hash = hash_pixels(buf, (size_t)3 * w * h);
+    changed[t] = tiles->fresh || hash != tiles->hash[layer][t];
+    if (changed[t]) {
+      tiles->hash[layer][t] = hash;
+      region_t r = { buf, (size_t)3 * w, (size_t)3 * w };
+      write_tile(tiles, world, layer, 0, tx, ty, &r, w, h);
+      if (next != NULL) {
+        downsample(buf, (size_t)3 * w, w, h,
+          next + ty * (TILE_SIZE / 2) * next_stride + tx * (TILE_SIZE / 2) * 3,
+          next_stride);
+      }
+    }
+    free(buf);
+  }
+}
+
+/* Writes tiles of level k that are made of changed tiles of level k-1 */
+static void write_level(
+  tiles_t *tiles, const world_t *world, int layer, int k)
+{
+  int      level_n = tiles->level_n;
+  int      tile_n  = tiles->tile_x[k] * tiles->tile_y[k];
+  uint8_t *changed = tiles->changed[layer * level_n + k];
+  uint8_t *below   = tiles->changed[layer * level_n + k - 1];
+  memset(changed, 0, tile_n);
+  for (int t = 0; t < tiles->tile_x[k-1] * tiles->tile_y[k-1]; ++t) {
+    if (below[t]) {
+      int tx = t % tiles->tile_x[k-1];
+      int ty = t / tiles->tile_x[k-1];
+      changed[(ty / 2) * tiles->tile_x[k] + tx / 2] = 1;
+    }
+  }
+
+  uint8_t *pixels = tiles->pixels[layer * level_n + k];
+  size_t   stride = (size_t)3 * (((tiles->size_x - 1) >> k) + 1);
+  uint8_t *next   = (k + 1 < level_n
+                      ? tiles->pixels[layer * level_n + k + 1] : NULL);
+  size_t   next_stride = (size_t)3 * (((tiles->size_x - 1) >> (k + 1)) + 1);
+  #pragma omp parallel for schedule(dynamic)
+  for (int t = 0; t < tile_n; ++t) {
+    if (!changed[t]) continue;
+    int tx, ty, w, h;
+    tile_bounds(tiles, k, t, &tx, &ty, &w, &h);
+    const uint8_t *origin = pixels + ty * TILE_SIZE * stride
+      + tx * TILE_SIZE * 3;
+    region_t r = { origin, stride, (size_t)3 * w };
+    write_tile(tiles, world, layer, k, tx, ty, &r, w, h);
+    if (next != NULL) {
+      downsample(origin, stride, w, h,
+        next + ty * (TILE_SIZE / 2) * next_stride + tx * (TILE_SIZE / 2) * 3,
+        next_stride);
+    }
+  }
+}
+
+static void write_index(const tiles_t *tiles, const world_t *world) {
+  char *fname = malloc(strlen(tiles->dir) + 32);
+  char *tmp   = malloc(strlen(tiles->dir) + 32);
+  sprintf(fname, "%s/tiles.txt", tiles->dir);
+  sprintf(tmp, "%s/tiles.txt.tmp", tiles->dir);
+  FILE *file = fopen(tmp, "w");
+  if (file == NULL) {
+    error(0, errno, "cannot open file `%s'", tmp);
+  } else {
+    fprintf(file, "step %lu\nsize %d %d\ntile %d\nlevels %d\nlayers",
+      world->step, tiles->size_x, tiles->size_y, TILE_SIZE, tiles->level_n);
+    for (int l = 0; l < tiles->layer_n; ++l) {
+      fprintf(file, " %s", layer_names[l]);
+    }
+    fprintf(file, "\n");
+    fclose(file);
+    if (rename(tmp, fname) != 0) {
+      error(0, errno, "cannot rename file `%s'", tmp);
+    }
+  }
+  free(fname);
+  free(tmp);
+}
+
+/* Writes the tiles that have changed since the previous frame. Pixels of
+ * level 0 are redrawn and compared by hashes, which is cheap compared to
+ * compressing, and higher levels are kept in memory and updated only in
+ * changed places. */
+void tiles_write(tiles_t *tiles, const world_t *world) {
+  for (int l = 0; l < tiles->layer_n; ++l) {
+    write_base(tiles, world, l);
+    for (int k = 1; k < tiles->level_n; ++k) {
+      write_level(tiles, world, l, k);
+    }
+  }
+  tiles->fresh = 0;
+  write_index(tiles, world);
+}
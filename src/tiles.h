@@ -0,0 +1,40 @@
+#ifndef __TILES_H
+#define __TILES_H
+
+#include "settings.h"
+
+#include <stdint.h>
+
+#define TILE_SIZE 256
+
+#define TILE_LAYER_SCORE   0
+#define TILE_LAYER_SPECIES 1
+
+struct world;
+
+/* Pyramid of square tiles of TILE_SIZE pixels. Level 0 has a pixel per
+ * cell, and each next level halves the resolution, until the whole board
+ * fits in one tile. A tile of level 0 is written only when its pixels have
+ * changed since the previous frame, and a tile of a higher level only when
+ * one of the tiles it is made of has changed. Tiles are written in
+ * DIR/<layer>/<z>/<x>_<y>.png, where z is 0 for the coarsest level (as in
+ * web maps), and DIR/tiles.txt describes the last frame. */
+typedef struct tiles {
+  const char *dir;
+  int         size_x;
+  int         size_y;
+  int         level_n;
+  int         layer_n;   /* scores, and species if the map is enabled */
+  int        *tile_x;    /* number of tiles of each level */
+  int        *tile_y;
+  uint64_t   *hash[2];   /* of pixels of tiles of level 0, per layer */
+  uint8_t   **pixels;    /* of levels above 0, per layer */
+  uint8_t   **changed;   /* flags of tiles of each level */
+  int         fresh;     /* nothing written yet */
+} tiles_t;
+
+void tiles_open(tiles_t *tiles, const settings_t *settings);
+void tiles_close(tiles_t *tiles);
+void tiles_write(tiles_t *tiles, const struct world *world);
+
+#endif
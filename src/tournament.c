@@ -0,0 +1,587 @@
+#include <argp.h>
+#include <errno.h>
+#include <error.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "automaton.h"
+#include "serialization.h"
+#include "settings.h"
+
+#define STR_(x) #x
+#define STR(x) STR_(x)
+
+#define DFLT_GAMES 100
+
+/* ========================================================================= */
+/* Argument parsing */
+
+const char *argp_program_version = "trust-tournament " TRUST_VERSION;
+static const char doc[] =
+  "Tournament of automata of the evolution of trust.\n"
+  "Plays every entrant against every other one, and prints the average "
+  "score per game of each entrant against each other one. An entrant is "
+  "a world file (all automata of the population, each equally likely to "
+  "be picked), an example automaton saved as a Graphviz script by trust "
+  "(-x option), or a name of a classic strategy: always-cooperate, "
+  "always-defect, tit-for-tat, suspicious-tit-for-tat, tit-for-two-tats, "
+  "grim or pavlov.\v"
+  "Game settings (turns, payoff matrix, mistakes, flags of automata) are "
+  "taken from the first world file, or are the defaults of trust, and can "
+  "be changed by options. Identical automata are played only once, so "
+  "large populations of a few species are cheap to evaluate.";
+
+static const char args_doc[] = "ENTRANT...";
+
+#define OPT_TURNS          't'
+#define OPT_GAMES          'g'
+#define OPT_MISTAKE_RATE   'm'
+#define OPT_MISTAKE_AWARE  'a'
+#define OPT_DECISION_AWARE 'A'
+#define OPT_SAMPLE         'n'
+#define OPT_INVASION       'I'
+#define OPT_PAYOFF         128
+#define OPT_SEED           129
+
+static struct argp_option options[] =
+  { { "turns", OPT_TURNS, "TURNS", 0,
+      "Specify the number of turns in each game" }
+  , { "games", OPT_GAMES, "N", 0,
+      "Specify the number of games played by each pair of automata, when "
+      "the games are random (default is " STR(DFLT_GAMES) ")" }
+  , { "mistake-rate", OPT_MISTAKE_RATE, "RATE", 0,
+      "Specify how often automata make mistakes" }
+  , { "mistake-aware", OPT_MISTAKE_AWARE, 0, 0,
+      "Automata are aware of their mistakes" }
+  , { "decision-aware", OPT_DECISION_AWARE, 0, 0,
+      "Automata are aware of their decisions" }
+  , { "payoff", OPT_PAYOFF, "MATRIX", 0,
+      "Specify the payoff matrix, as in trust" }
+  , { "sample", OPT_SAMPLE, "N", 0,
+      "Pick at most N automata from each world file "
+      "(default is 0, which takes all of them)" }
+  , { "seed", OPT_SEED, "SEED", 0,
+      "Specify the seed of the random number generator" }
+  , { "invasion", OPT_INVASION, 0, 0,
+      "Print also the invasion fitness of each entrant (the row) in the "
+      "population of each other one (the column): the score of a rare "
+      "mutant against residents, less the score of residents against "
+      "themselves. Positive values mean that the mutant invades" }
+  , { 0 }
+  };
+
+typedef struct options {
+  int           turn_n;
+  int           game_n;
+  int           sample_n;
+  int           flags;
+  int           invasion;
+  double        mistake_rate;
+  const char   *payoff;
+  unsigned long seed;
+  int           entrant_n;
+  char        **entrant_name;
+} options_t;
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state) {
+  options_t *opts = state->input;
+  switch (key) {
+  case OPT_TURNS:
+    if (parse_number(arg, &opts->turn_n, 1, MAX_TURN_N) != CHECK_OK) {
+      argp_error(state, "The number of turns must be in range between "
+        "1 and " STR(MAX_TURN_N) ".");
+    }
+    break;
+  case OPT_GAMES:
+    if (parse_number(arg, &opts->game_n, 1, INT_MAX) != CHECK_OK) {
+      argp_error(state, "The number of games must be positive.");
+    }
+    break;
+  case OPT_SAMPLE:
+    if (parse_number(arg, &opts->sample_n, 0, INT_MAX) != CHECK_OK) {
+      argp_error(state, "Invalid sample size `%s'.", arg);
+    }
+    break;
+  case OPT_MISTAKE_RATE:
+    opts->mistake_rate = atof(arg);
+    break;
+  case OPT_MISTAKE_AWARE:
+    opts->flags |= F_MISTAKE_AWARE;
+    break;
+  case OPT_DECISION_AWARE:
+    opts->flags |= F_DECISION_AWARE;
+    break;
+  case OPT_PAYOFF:
+    opts->payoff = arg;
+    break;
+  case OPT_SEED:
+    opts->seed = atol(arg);
+    break;
+  case OPT_INVASION:
+    opts->invasion = 1;
+    break;
+  case ARGP_KEY_ARGS:
+    opts->entrant_n    = state->argc - state->next;
+    opts->entrant_name = state->argv + state->next;
+    break;
+  case ARGP_KEY_NO_ARGS:
+    argp_usage(state);
+    break;
+  default:
+    return ARGP_ERR_UNKNOWN;
+  }
+  return 0;
+}
+
+static struct argp argp = { options, parse_opt, args_doc, doc, 0, 0, 0 };
+
+/* ========================================================================= */
+/* Entrants */
+
+/* Group of automata, each taking part with equal weight */
+typedef struct entrant {
+  const char *name;
+  int         size;
+  int         state_n;
+  state_t    *states;  /* size * state_n */
+} entrant_t;
+
+#define C ACTION_RESOLUTION
+#define D 0
+
+/* Classic strategies, given by actions and successors on defection and
+ * cooperation of the opponent. The initial state goes first. */
+typedef struct classic {
+  const char *name;
+  int         state_n;
+  int         action[3];
+  int         next[3][2];
+} classic_t;
+
+static const classic_t classics[] =
+  { { "always-cooperate",       1, { C },       { { 0, 0 } } }
+  , { "always-defect",          1, { D },       { { 0, 0 } } }
+  , { "tit-for-tat",            2, { C, D },    { { 1, 0 }, { 1, 0 } } }
+  , { "suspicious-tit-for-tat", 2, { D, C },    { { 0, 1 }, { 0, 1 } } }
+  , { "tit-for-two-tats",       3, { C, C, D },
+                                   { { 1, 0 }, { 2, 0 }, { 2, 0 } } }
+  , { "grim",                   2, { C, D },    { { 1, 0 }, { 1, 1 } } }
+  , { "pavlov",                 2, { C, D },    { { 1, 0 }, { 0, 1 } } }
+  };
+
+#undef C
+#undef D
+
+static int load_classic(entrant_t *e, const char *name) {
+  for (size_t c = 0; c < sizeof(classics) / sizeof(classics[0]); ++c) {
+    const classic_t *cl = &classics[c];
+    if (strcmp(cl->name, name) != 0) {
+      continue;
+    }
+    e->size    = 1;
+    e->state_n = cl->state_n;
+    e->states  = malloc(sizeof(state_t) * cl->state_n);
+    for (int k = 0; k < cl->state_n; ++k) {
+      e->states[k].action = cl->action[k];
+      for (int e2 = 0; e2 < 8; ++e2) {
+        /* the last index of next is the action of the opponent */
+        e->states[k].next_tab[e2] = cl->next[k][e2 & 1];
+      }
+    }
+    return CHECK_OK;
+  }
+  return CHECK_FAIL;
+}
+
+/* Reads an automaton printed by automaton_print(). Edges that are not
+ * shown are never taken, and missing states are unreachable. */
+static void load_graphviz(entrant_t *e, FILE *file) {
+  char line[256];
+  char label[32];
+  int  from;
+  int  to;
+  int  max_st = 0;
+  e->size    = 1;
+  e->state_n = MAX_STATE_N;
+  e->states  = calloc(MAX_STATE_N, sizeof(state_t));
+  while (fgets(line, sizeof(line), file) != NULL) {
+    if (sscanf(line, " node [shape = %*[a-z], label = \"%31[^\"]\"] ST_%d",
+      label, &from) == 2)
+    {
+      if (from < 0 || from >= MAX_STATE_N) {
+        error(EXIT_FAILURE, 0, "invalid state ST_%d in `%s'", from, e->name);
+      }
+      double p = atof(label[0] == 'S' ? label + 1 : label);
+      e->states[from].action = (int)(p * ACTION_RESOLUTION + 0.5);
+      max_st = (from > max_st ? from : max_st);
+    } else if (sscanf(line, " ST_%d -> ST_%d [label = \"%31[^\"]\"]",
+      &from, &to, label) == 3)
+    {
+      if (from < 0 || from >= MAX_STATE_N || to < 0 || to >= MAX_STATE_N) {
+        error(EXIT_FAILURE, 0, "invalid edge ST_%d -> ST_%d in `%s'",
+          from, to, e->name);
+      }
+      int err = (label[0] == '#');
+      int len = strlen(label + 1);
+      for (int dec = 0; dec < 2; ++dec) {
+        if (len == 2 && label[1] - '0' != dec) {
+          continue;
+        }
+        int opp = label[len] - '0';
+        e->states[from].next[err][dec][opp & 1] = to;
+      }
+      max_st = (to > max_st ? to : max_st);
+      max_st = (from > max_st ? from : max_st);
+    }
+  }
+  e->state_n = max_st + 1;
+}
+
+/* Reads the population of a world file, and its settings */
+static void load_world(
+  entrant_t  *e,
+  FILE       *file,
+  settings_t *settings,
+  int         sample_n,
+  MTRand     *rand)
+{
+  population_t  pop;
+  unsigned long step;
+  deserialize_version(file, "trust_version", TRUST_VERSION);
+  settings_deserialize(file, settings);
+  deserialize_tag(file, "WORLD");
+  deserialize_ulong(file, "step", &step, 0, ULONG_MAX);
+  int size = settings->board_size_x * settings->board_size_y;
+  population_init(&pop, size, settings->state_n);
+  for (int i = 0; i < size; ++i) {
+    automaton_deserialize(file, &pop, i);
+  }
+
+  /* a sample is a random subset, picked by a partial shuffle */
+  int *pick = malloc(sizeof(int) * size);
+  for (int i = 0; i < size; ++i) {
+    pick[i] = i;
+  }
+  e->size = (sample_n > 0 && sample_n < size ? sample_n : size);
+  for (int i = 0; i < e->size && e->size < size; ++i) {
+    int k = i + genRandBounded(rand, size - i);
+    int t = pick[i];
+    pick[i] = pick[k];
+    pick[k] = t;
+  }
+  e->state_n = settings->state_n;
+  e->states  = malloc(sizeof(state_t) * e->size * e->state_n);
+  for (int i = 0; i < e->size; ++i) {
+    memcpy(&e->states[(size_t)i * e->state_n], pop.genome[pick[i]],
+      sizeof(state_t) * e->state_n);
+  }
+  free(pick);
+  population_destroy(&pop);
+}
+
+static int is_world_file(FILE *file) {
+  char head[16];
+  int  world = fgets(head, sizeof(head), file) != NULL
+            && strncmp(head, "trust_version", 13) == 0;
+  rewind(file);
+  return world;
+}
+
+/* ========================================================================= */
+/* Tournament */
+
+typedef struct tournament {
+  settings_t    settings;
+  population_t  pop;      /* all automata of all entrants */
+  int           uniq_n;
+  int          *uniq;     /* representatives of distinct automata */
+  int          *uniq_of;  /* automaton -> index of its representative */
+  float        *result;   /* average score of u against v, uniq_n^2 */
+} tournament_t;
+
+static const population_t *sort_pop;
+
+/* Compares play tables, which are zeroed past their reachable states */
+static int cmp_play(const population_t *pop, int i, int j) {
+  return memcmp(pop->play[i], pop->play[j], sizeof(state_t) * pop->state_n);
+}
+
+/* Orders automata by hashes, and by play tables when hashes collide, so
+ * that identical ones are adjacent */
+static int cmp_by_hash(const void *a, const void *b) {
+  int      i  = *(const int *)a;
+  int      j  = *(const int *)b;
+  uint64_t hi = sort_pop->hash[i];
+  uint64_t hj = sort_pop->hash[j];
+  if (hi != hj) {
+    return hi < hj ? -1 : 1;
+  }
+  int c = cmp_play(sort_pop, i, j);
+  return c != 0 ? c : i - j;
+}
+
+static void tournament_init(
+  tournament_t *t, const entrant_t *entrant, int entrant_n)
+{
+  int size    = 0;
+  int state_n = 1;
+  for (int g = 0; g < entrant_n; ++g) {
+    size   += entrant[g].size;
+    state_n = (entrant[g].state_n > state_n ? entrant[g].state_n : state_n);
+  }
+  t->settings.state_n = state_n;
+  population_init(&t->pop, size, state_n);
+  int i = 0;
+  for (int g = 0; g < entrant_n; ++g) {
+    for (int a = 0; a < entrant[g].size; ++a, ++i) {
+      state_t *dst = t->pop.genome[i];
+      memset(dst, 0, sizeof(state_t) * state_n);
+      memcpy(dst, &entrant[g].states[(size_t)a * entrant[g].state_n],
+        sizeof(state_t) * entrant[g].state_n);
+      automaton_canonicalise(dst, state_n, &t->settings);
+      memset(t->pop.play[i], 0, sizeof(state_t) * state_n);
+      automaton_compact(&t->pop, i, &t->settings);
+    }
+  }
+
+  /* automata are identical, when their play tables are */
+  int *by_hash = malloc(sizeof(int) * size);
+  for (i = 0; i < size; ++i) {
+    by_hash[i] = i;
+  }
+  sort_pop = &t->pop;
+  qsort(by_hash, size, sizeof(int), cmp_by_hash);
+  t->uniq    = malloc(sizeof(int) * size);
+  t->uniq_of = malloc(sizeof(int) * size);
+  t->uniq_n  = 0;
+  for (int k = 0; k < size; ++k) {
+    i = by_hash[k];
+    if (k == 0 || t->pop.hash[i] != t->pop.hash[by_hash[k - 1]]
+      || cmp_play(&t->pop, i, by_hash[k - 1]) != 0)
+    {
+      t->uniq[t->uniq_n++] = i;
+    }
+    t->uniq_of[i] = t->uniq_n - 1;
+  }
+  free(by_hash);
+}
+
+static void tournament_destroy(tournament_t *t) {
+  population_destroy(&t->pop);
+  free(t->uniq);
+  free(t->uniq_of);
+  free(t->result);
+}
+
+/* Games are not random, when there are no mistakes and every automaton
+ * either always cooperates or never does in each state */
+static int tournament_is_pure(const tournament_t *t) {
+  if (t->settings.mistake_rate > 0) {
+    return 0;
+  }
+  for (size_t k = 0; k < (size_t)t->pop.size * t->pop.state_n; ++k) {
+    int action = t->pop.states[k].action;
+    if (action != 0 && action != ACTION_RESOLUTION) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Plays every pair of distinct automata (and every automaton against
+ * itself). Rows are handed to threads, each with its own generator
+ * seeded by the row, so results do not depend on the number of threads. */
+static void tournament_play(tournament_t *t, int game_n) {
+  int n = t->uniq_n;
+  t->result = malloc(sizeof(float) * n * n);
+  if (tournament_is_pure(t)) {
+    game_n = 1;
+  }
+  #pragma omp parallel for schedule(dynamic)
+  for (int u = 0; u < n; ++u) {
+    MTRand rand = seedRand(t->settings.seed + u);
+    for (int v = u; v < n; ++v) {
+      long sum_u = 0;
+      long sum_v = 0;
+      for (int g = 0; g < game_n; ++g) {
+        int score_v;
+        sum_u += automaton_game(&t->pop, t->uniq[u], t->uniq[v],
+          &t->settings, &rand, &score_v);
+        sum_v += score_v;
+      }
+      double avg_u = (double)sum_u / game_n;
+      double avg_v = (double)sum_v / game_n;
+      if (u == v) {
+        avg_u = avg_v = (avg_u + avg_v) / 2;
+      }
+      t->result[(size_t)u * n + v] = (float)avg_u;
+      t->result[(size_t)v * n + u] = (float)avg_v;
+    }
+  }
+}
+
+/* Distinct automata of an entrant, with their numbers of copies */
+typedef struct mix {
+  int  n;
+  int *uniq;
+  int *count;
+  int  size;
+} mix_t;
+
+static void mix_init(mix_t *m, const tournament_t *t, int first, int size) {
+  int *count = calloc(t->uniq_n, sizeof(int));
+  m->n     = 0;
+  m->uniq  = malloc(sizeof(int) * size);
+  m->count = malloc(sizeof(int) * size);
+  m->size  = size;
+  for (int i = first; i < first + size; ++i) {
+    int u = t->uniq_of[i];
+    if (count[u]++ == 0) {
+      m->uniq[m->n++] = u;
+    }
+  }
+  for (int k = 0; k < m->n; ++k) {
+    m->count[k] = count[m->uniq[k]];
+  }
+  free(count);
+}
+
+static void mix_destroy(mix_t *m) {
+  free(m->uniq);
+  free(m->count);
+}
+
+/* Average score of a member of a against a member of b */
+static double mix_score(const tournament_t *t, const mix_t *a, const mix_t *b)
+{
+  double sum = 0.0;
+  for (int k = 0; k < a->n; ++k) {
+    const float *row = &t->result[(size_t)a->uniq[k] * t->uniq_n];
+    double s = 0.0;
+    for (int l = 0; l < b->n; ++l) {
+      s += (double)b->count[l] * row[b->uniq[l]];
+    }
+    sum += a->count[k] * s;
+  }
+  return sum / ((double)a->size * b->size);
+}
+
+static void print_matrix(
+  const char *title, const double *m, const entrant_t *entrant, int n)
+{
+  printf("# %s\n", title);
+  for (int b = 0; b < n; ++b) {
+    printf("\t%s", entrant[b].name);
+  }
+  printf("\n");
+  for (int a = 0; a < n; ++a) {
+    printf("%s", entrant[a].name);
+    for (int b = 0; b < n; ++b) {
+      printf("\t%f", m[a * n + b]);
+    }
+    printf("\n");
+  }
+}
+
+/* ========================================================================= */
+
+int main(int argc, char **argv) {
+  options_t opts =
+    { .turn_n       = 0
+    , .game_n       = DFLT_GAMES
+    , .sample_n     = 0
+    , .flags        = 0
+    , .invasion     = 0
+    , .mistake_rate = -1.0
+    , .payoff       = NULL
+    , .seed         = DFLT_SEED
+    , .entrant_n    = 0
+    , .entrant_name = NULL
+    };
+  argp_parse(&argp, argc, argv, 0, 0, &opts);
+
+  tournament_t t;
+  settings_default(&t.settings);
+  int        have_world = 0;
+  MTRand     rand       = seedRand(opts.seed);
+  int        n          = opts.entrant_n;
+  entrant_t *entrant    = malloc(sizeof(entrant_t) * n);
+  for (int g = 0; g < n; ++g) {
+    entrant[g].name = opts.entrant_name[g];
+    if (load_classic(&entrant[g], entrant[g].name) == CHECK_OK) {
+      continue;
+    }
+    FILE *file = fopen(entrant[g].name, "r");
+    if (file == NULL) {
+      error(EXIT_FAILURE, errno, "cannot open file `%s'", entrant[g].name);
+    }
+    if (is_world_file(file)) {
+      settings_t settings;
+      settings_default(&settings);
+      load_world(&entrant[g], file, &settings, opts.sample_n, &rand);
+      if (!have_world) {
+        t.settings = settings;
+        have_world = 1;
+      }
+    } else {
+      load_graphviz(&entrant[g], file);
+    }
+    fclose(file);
+  }
+
+  if (opts.turn_n > 0) {
+    t.settings.turn_n = opts.turn_n;
+  }
+  if (opts.mistake_rate >= 0.0) {
+    t.settings.mistake_rate = fpoint(opts.mistake_rate);
+  }
+  if (opts.payoff != NULL && parse_payoff(opts.payoff, &t.settings)) {
+    error(EXIT_FAILURE, 0, "invalid payoff matrix `%s'", opts.payoff);
+  }
+  t.settings.flags |= opts.flags;
+  t.settings.seed   = opts.seed;
+
+  tournament_init(&t, entrant, n);
+  tournament_play(&t, opts.game_n);
+
+  mix_t  *mix   = malloc(sizeof(mix_t) * n);
+  double *score = malloc(sizeof(double) * n * n);
+  int     first = 0;
+  for (int g = 0; g < n; ++g) {
+    mix_init(&mix[g], &t, first, entrant[g].size);
+    first += entrant[g].size;
+  }
+  #pragma omp parallel for collapse(2) schedule(dynamic)
+  for (int a = 0; a < n; ++a) {
+    for (int b = 0; b < n; ++b) {
+      score[a * n + b] = mix_score(&t, &mix[a], &mix[b]);
+    }
+  }
+  printf("# %d automata, %d distinct, %d turns per game\n",
+    t.pop.size, t.uniq_n, t.settings.turn_n);
+  print_matrix("average score per game of the row against the column",
+    score, entrant, n);
+  if (opts.invasion) {
+    double *fitness = calloc(n * n, sizeof(double));
+    for (int a = 0; a < n; ++a) {
+      for (int b = 0; b < n; ++b) {
+        fitness[a * n + b] = score[a * n + b] - score[b * n + b];
+      }
+    }
+    print_matrix("invasion fitness of the row in the population of the "
+      "column", fitness, entrant, n);
+    free(fitness);
+  }
+
+  for (int g = 0; g < n; ++g) {
+    mix_destroy(&mix[g]);
+    free(entrant[g].states);
+  }
+  free(mix);
+  free(score);
+  free(entrant);
+  tournament_destroy(&t);
+  return 0;
+}
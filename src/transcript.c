@@ -0,0 +1,73 @@
+#include "transcript.h"
+
+#include "mtwister.h"
+
+#include <errno.h>
+#include <error.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Marks cells listed (as numbers, separated by commas) in str */
+static char *parse_cells(const char *str, int size) {
+  char *chosen = calloc(size, 1);
+  while (*str) {
+    char *end;
+    long  cell = strtol(str, &end, 10);
+    if (end == str || cell < 0 || cell >= size || (*end && *end != ',')) {
+      error(EXIT_FAILURE, 0, "invalid list of cells `%s'", str);
+    }
+    chosen[cell] = 1;
+    str = (*end ? end + 1 : end);
+  }
+  return chosen;
+}
+
+void transcript_open(transcript_t *tr, const settings_t *settings) {
+  const char *name = settings->transcript_name;
+  int size = settings->board_size_x * settings->board_size_y;
+  tr->rate   = settings->transcript_rate;
+  tr->seed   = mix64(settings->seed ^ 0x7472616e73637269ull);
+  tr->chosen = NULL;
+  if (settings->transcript_cells != NULL) {
+    tr->chosen = parse_cells(settings->transcript_cells, size);
+  }
+  tr->turns = malloc(sizeof(transcript_turn_t) * settings->turn_n);
+  tr->det_rand = seedRand(settings->seed);
+  /* transcripts of continued runs go to the same file */
+  tr->file = fopen(name, "ab");
+  if (tr->file == NULL) {
+    error(EXIT_FAILURE, errno, "cannot open file `%s'", name);
+  }
+  if (ftell(tr->file) == 0) {
+    uint32_t head[3] =
+      { TRANSCRIPT_VERSION
+      , sizeof(transcript_game_t)
+      , sizeof(transcript_turn_t)
+      };
+    fwrite(TRANSCRIPT_MAGIC, 1, 8, tr->file);
+    fwrite(head, sizeof(uint32_t), 3, tr->file);
+  }
+}
+
+void transcript_close(transcript_t *tr) {
+  fclose(tr->file);
+  free(tr->chosen);
+  free(tr->turns);
+}
+
+int transcript_sampled(
+  const transcript_t *tr, unsigned long step, int i, int j)
+{
+  if (tr->chosen != NULL && (tr->chosen[i] || tr->chosen[j])) {
+    return 1;
+  }
+  uint64_t h = mix64(tr->seed ^ step);
+  h = mix64(h ^ ((uint64_t)i << 32 | (uint32_t)j));
+  return (h & 0x7FFFFFFFul) < tr->rate;
+}
+
+/* Writes the game, with its turns taken from the buffer */
+void transcript_write(transcript_t *tr, const transcript_game_t *game) {
+  fwrite(game, sizeof(transcript_game_t), 1, tr->file);
+  fwrite(tr->turns, sizeof(transcript_turn_t), game->turn_n, tr->file);
+}
@@ -0,0 +1,54 @@
+#ifndef __TRANSCRIPT_H
+#define __TRANSCRIPT_H
+
+#include "mtwister.h"
+#include "settings.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define TRANSCRIPT_MAGIC   "TRUSTTRS"
+#define TRANSCRIPT_VERSION 1
+
+/* bits of moves of players */
+#define TRANSCRIPT_DECISION 0x1  /* decided to cooperate */
+#define TRANSCRIPT_MISTAKE  0x2
+#define TRANSCRIPT_ACTION   0x4  /* cooperated */
+
+/* A file holds a header (magic, version and sizes of both records as
+ * uint32_t), then games, each followed by turn_n turns. Records are in
+ * native byte order. States are numbers in play tables, i.e., reachable
+ * states renumbered in order, with the initial one 0. */
+typedef struct transcript_game {
+  uint64_t step;
+  uint64_t id[2];
+  uint32_t cell[2];
+  uint32_t turn_n;
+  int32_t  score[2];
+  uint32_t reserved;
+} transcript_game_t;
+
+typedef struct transcript_turn {
+  uint16_t state[2];
+  uint8_t  move[2];
+} transcript_turn_t;
+
+/* Games are sampled at the given rate, and always when one of the players
+ * is in a chosen cell. Sampling is a hash of the step and the cells, so it
+ * draws no random numbers and does not change the simulation. */
+typedef struct transcript {
+  FILE              *file;
+  unsigned long      rate;
+  uint64_t           seed;
+  char              *chosen;  /* cells, or NULL */
+  transcript_turn_t *turns;   /* buffer for one game */
+  MTRand             det_rand;  /* for deterministic games */
+} transcript_t;
+
+void transcript_open(transcript_t *tr, const settings_t *settings);
+void transcript_close(transcript_t *tr);
+int transcript_sampled(
+  const transcript_t *tr, unsigned long step, int i, int j);
+void transcript_write(transcript_t *tr, const transcript_game_t *game);
+
+#endif
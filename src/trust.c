@@ -0,0 +1,105 @@
+#include "trust.h"
+
+#include "world.h"
+
+#include <error.h>
+#include <stdlib.h>
+#include <string.h>
+
+int trust_api_version(void) {
+  return TRUST_API_VERSION;
+}
+
+/* Creates a new world. Settings are copied, but strings they point to
+ * must outlive the world. */
+trust_t *trust_create_sized(const settings_t *settings, size_t size) {
+  if (size != sizeof(settings_t)) {
+    error(EXIT_FAILURE, 0,
+      "settings do not match libtrust (API version %d)", TRUST_API_VERSION);
+  }
+  world_t *world = malloc(sizeof(world_t));
+  world->settings = *settings;
+  world->settings.flags |= F_QUIET;
+  world_init(world);
+  return world;
+}
+
+/* Loads the world saved by trust_save() or by the trust program */
+trust_t *trust_load(const char *name) {
+  world_t *world = malloc(sizeof(world_t));
+  world_load(world, name);
+  world->settings.flags |= F_QUIET;
+  return world;
+}
+
+/* Saves the world to the file name, through name.new */
+void trust_save(const trust_t *world, const char *name) {
+  char *tmp_name = malloc(strlen(name) + 5);
+  strcpy(tmp_name, name);
+  strcat(tmp_name, ".new");
+  world_save(world, name, tmp_name);
+  free(tmp_name);
+}
+
+void trust_destroy(trust_t *world) {
+  world_destroy(world);
+  free(world);
+}
+
+static int trust_stopped(const trust_t *world) {
+  if (world->steady && world->settings.steady_policy != STEADY_THROTTLE) {
+    return 1;
+  }
+  return world->settings.step_n != 0
+      && world->step >= world->settings.step_n;
+}
+
+/* Makes at most n steps, and returns the number of steps made, which is
+ * smaller than n if the world stopped (after step_n steps or in the
+ * steady state) */
+unsigned long trust_step(trust_t *world, unsigned long n) {
+  unsigned long done = 0;
+  while (done < n && !trust_stopped(world)) {
+    world_reset(world);
+    world_play(world);
+    world_kill_weak(world);
+    world_spawn_new(world);
+    world_report(world);
+    done++;
+    world_next_step(world);
+  }
+  return done;
+}
+
+const settings_t *trust_settings(const trust_t *world) {
+  return &world->settings;
+}
+
+unsigned long trust_step_count(const trust_t *world) {
+  return world->step;
+}
+
+int trust_cell_count(const trust_t *world) {
+  return world->pop.size;
+}
+
+double trust_avg_score(const trust_t *world) {
+  return world_avg_score(world);
+}
+
+const int *trust_scores(const trust_t *world) {
+  return world->pop.score;
+}
+
+const char *trust_statuses(const trust_t *world) {
+  return world->pop.status;
+}
+
+const unsigned *trust_colors(const trust_t *world) {
+  return world->pop.color;
+}
+
+/* Genomes have settings->state_n states; the initial one is the first */
+const state_t *const *trust_genomes(const trust_t *world) {
+  return (const state_t *const *)world->pop.genome;
+}
@@ -0,0 +1,44 @@
+#ifndef __TRUST_H
+#define __TRUST_H
+
+/* Public interface of libtrust, for programs that run simulations
+ * in-process. Worlds are opaque; arrays returned by accessors belong to
+ * the world, are indexed by cells (y * board_size_x + x), and stay valid
+ * until the next call to trust_step() or trust_destroy(). Like the trust
+ * program, the library exits the process on fatal errors (e.g., files
+ * that cannot be opened), but it prints nothing on its own.
+ *
+ * settings_t is part of the interface: TRUST_API_VERSION changes whenever
+ * its layout does, and trust_create() checks the size the caller was
+ * compiled with. */
+
+#include "automaton.h"
+#include "settings.h"
+
+#define TRUST_API_VERSION 2
+
+typedef struct world trust_t;
+
+int trust_api_version(void);
+
+#define trust_create(settings) \
+  trust_create_sized((settings), sizeof(settings_t))
+
+trust_t *trust_create_sized(const settings_t *settings, size_t size);
+trust_t *trust_load(const char *name);
+void trust_save(const trust_t *world, const char *name);
+void trust_destroy(trust_t *world);
+
+unsigned long trust_step(trust_t *world, unsigned long n);
+
+const settings_t *trust_settings(const trust_t *world);
+unsigned long trust_step_count(const trust_t *world);
+int trust_cell_count(const trust_t *world);
+double trust_avg_score(const trust_t *world);
+
+const int *trust_scores(const trust_t *world);
+const char *trust_statuses(const trust_t *world);
+const unsigned *trust_colors(const trust_t *world);
+const state_t *const *trust_genomes(const trust_t *world);
+
+#endif
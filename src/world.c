@@ -1,18 +1,136 @@
 #include "world.h"
 #include "world_image.h"
+#include "graph.h"
+#include "layout.h"
 #include "serialization.h"
 
+#include <dirent.h>
 #include <errno.h>
 #include <error.h>
 #include <limits.h>
 #include <string.h>
 
+static void history_keyframe(world_t *world);
+static void history_delta(world_t *world);
+
 static int board_size(const world_t *world) {
   return world->settings.board_size_x * world->settings.board_size_y;
 }
 
+static int world_layout(const world_t *world) {
+  if (world->settings.flags & F_LAYOUT_HILBERT) {
+    return LAYOUT_HILBERT;
+  }
+  if (world->settings.flags & F_LAYOUT_MORTON) {
+    return LAYOUT_MORTON;
+  }
+  return LAYOUT_RASTER;
+}
+
+/* The t-th cell in the order of traversal */
+static int world_cell(const world_t *world, int t) {
+  return world->order == NULL ? t : world->order[t];
+}
+
+static graph_t *neighbourhood(const graph_t *g, int radius, int with_self) {
+  graph_t *nb = malloc(sizeof(graph_t));
+  graph_ball(nb, g, radius, with_self);
+  return nb;
+}
+
+/* Builds neighbourhoods for topologies other than the torus, which has
+ * specialised kernels. Irregular graphs are traversed in an order that
+ * keeps neighbours close. */
+static void world_build_graphs(world_t *world) {
+  graph_t g;
+  graph_generate(&g, &world->settings);
+  world->play_nb  = neighbourhood(&g, world->settings.play_area, 0);
+  world->kill_nb  = neighbourhood(&g, world->settings.kill_area, 1);
+  world->cross_nb = neighbourhood(&g, world->settings.cross_area, 1);
+  if (world->settings.topology == TOPOLOGY_SCALE_FREE
+    || world->settings.topology == TOPOLOGY_FILE)
+  {
+    world->order = graph_order(&g);
+  }
+  graph_destroy(&g);
+}
+
+/* The population is placed in the persistent world, if it is set */
 static void world_basic_init(world_t *world, int continued) {
-  world->pop = malloc(sizeof(automaton_t) * board_size(world));
+  if (world->persist != NULL) {
+    population_map(&world->pop, board_size(world), world->settings.state_n,
+      world->persist->live);
+  } else {
+    population_init(&world->pop, board_size(world),
+      world->settings.state_n);
+  }
+  world->order    = NULL;
+  world->play_nb  = NULL;
+  world->kill_nb  = NULL;
+  world->cross_nb = NULL;
+  graph_walk_init(&world->walk);
+  if (world->settings.topology != TOPOLOGY_TORUS) {
+    world_build_graphs(world);
+  }
+  if (world->order == NULL) {
+    world->order = layout_order(world->settings.board_size_x,
+      world->settings.board_size_y, world_layout(world));
+  }
+  if (world->order != NULL) {
+    population_arrange(&world->pop, world->order);
+  }
+  if (world->settings.lineage_name != NULL) {
+    world->lineage = malloc(sizeof(lineage_t));
+    lineage_open(world->lineage, world->settings.lineage_name);
+  } else {
+    world->lineage = NULL;
+  }
+  if (world->settings.live_name != NULL) {
+    world->live = malloc(sizeof(live_t));
+    live_open(world->live, world->settings.live_name,
+      world->settings.board_size_x, world->settings.board_size_y);
+  } else {
+    world->live = NULL;
+  }
+  if (world->settings.transcript_name != NULL) {
+    world->transcript = malloc(sizeof(transcript_t));
+    transcript_open(world->transcript, &world->settings);
+  } else {
+    world->transcript = NULL;
+  }
+  if (world->settings.tiles_name != NULL) {
+    world->tiles = malloc(sizeof(tiles_t));
+    tiles_open(world->tiles, &world->settings);
+  } else {
+    world->tiles = NULL;
+  }
+  world->delta_file   = NULL;
+  world->delta_score  = world->settings.history_name == NULL ? NULL
+    : calloc(board_size(world), sizeof(int));
+  world->dirty        = malloc(sizeof(int) * board_size(world));
+  world->scores_valid = 0;
+  world->kill_min = malloc(sizeof(int) * board_size(world));
+  world->kill_tmp = malloc(sizeof(int) * board_size(world));
+  world->covered  = malloc(sizeof(uint64_t)
+    * ((world->settings.board_size_x + 63) / 64)
+    * world->settings.board_size_y);
+  world->surv_rank = malloc(sizeof(int) * board_size(world));
+  world->surv_x    = malloc(sizeof(int) * board_size(world));
+  world->surv_row  = malloc(sizeof(int) * (world->settings.board_size_y + 1));
+  world->surv_cum  = malloc(sizeof(int)
+    * (world->settings.board_size_y + 1) * world->settings.board_size_x);
+  /* every automaton is new to the detection of the steady state */
+  world->births      = board_size(world);
+  world->genome_hash = 0;
+  world->hash_since  = 0;
+  world->genome_of   = NULL;
+  world->score_win   = malloc(sizeof(double) * world->settings.steady_window);
+  world->species_of  = NULL;
+  world->score_sum   = 0.0;
+  world->score_sq    = 0.0;
+  world->score_n     = 0;
+  world->steady      = 0;
+  world->steady_step = ULONG_MAX;
   if (world->settings.stat_file == NULL) {
     world->stat_file = NULL;
   } else if (strcmp(world->settings.stat_file, "-") == 0) {
@@ -27,34 +145,345 @@ static void world_basic_init(world_t *world, int continued) {
   }
 }
 
+/* Counts species of all automata from scratch */
+static void world_count_species(world_t *world) {
+  if ((world->settings.flags & F_SPECIES_BEHAVE) == 0) {
+    return;
+  }
+  species_count_init(&world->species, board_size(world));
+  world->species_of = malloc(sizeof(uint64_t) * board_size(world));
+  for (int i = 0; i < board_size(world); ++i) {
+    world->species_of[i] = world->pop.species[i];
+    species_count_add(&world->species, world->species_of[i], 1);
+  }
+}
+
+/* Counts genomes of all automata from scratch, for the detection of the
+ * steady state. Genomes are identified by hashes of their play tables. */
+static void world_count_genomes(world_t *world) {
+  if (world->settings.steady_window == 0) {
+    return;
+  }
+  species_count_init(&world->genomes, board_size(world));
+  world->genome_of   = malloc(sizeof(uint64_t) * board_size(world));
+  world->genome_hash = 0;
+  for (int i = 0; i < board_size(world); ++i) {
+    world->genome_of[i] = world->pop.hash[i];
+    if (species_count_add(&world->genomes, world->genome_of[i], 1) == 1) {
+      world->genome_hash += mix64(world->genome_of[i]);
+    }
+  }
+  world->hash_since = world->step;
+}
+
+/* Moves the automaton at i to the count of its new genome. The hash of the
+ * set of genomes is the sum of mix64 of genomes present, so it changes
+ * exactly when a genome appears or dies out. */
+static void world_move_genome(world_t *world, int i) {
+  uint64_t old = world->genome_of[i];
+  uint64_t new = world->pop.hash[i];
+  if (old == new) {
+    return;
+  }
+  if (species_count_add(&world->genomes, old, -1) == 0) {
+    world->genome_hash -= mix64(old);
+    world->hash_since   = world->step;
+  }
+  if (species_count_add(&world->genomes, new, 1) == 1) {
+    world->genome_hash += mix64(new);
+    world->hash_since   = world->step;
+  }
+  world->genome_of[i] = new;
+}
+
+/* Moves newborn automata from species and genomes of their predecessors
+ * to their own. Both are identified in parallel at birth, so only the
+ * counting is left here. */
+static void world_update_counts(world_t *world) {
+  if (world->species_of == NULL && world->genome_of == NULL) {
+    return;
+  }
+  for (int i = 0; i < board_size(world); ++i) {
+    if (world->pop.status[i] != A_ST_DEAD) {
+      continue;
+    }
+    uint64_t species = world->pop.species[i];
+    if (world->species_of != NULL && world->species_of[i] != species) {
+      species_count_add(&world->species, world->species_of[i], -1);
+      species_count_add(&world->species, species, 1);
+      world->species_of[i] = species;
+    }
+    if (world->genome_of != NULL) {
+      world_move_genome(world, i);
+    }
+  }
+}
+
 void world_init(world_t *world) {
+  if (world->settings.persist_name != NULL) {
+    world->persist = malloc(sizeof(persist_t));
+    persist_create(world->persist, &world->settings,
+      population_layout(board_size(world), world->settings.state_n));
+  } else {
+    world->persist = NULL;
+  }
   world_basic_init(world, 0);
   world->rand = seedRand(world->settings.seed);
   world->step = 0;
   for (int i = 0; i < board_size(world); ++i) {
-    automaton_init(&world->pop[i], &world->settings, &world->rand);
+    automaton_init(&world->pop, i, &world->settings, &world->rand);
+    world->pop.id[i] = i;
   }
+  world_count_species(world);
+  world_count_genomes(world);
+  history_keyframe(world);
 }
 
 void world_destroy(world_t *world) {
-  for (int i = 0; i < board_size(world); ++i) {
-    automaton_destroy(&world->pop[i]);
+  if (world->delta_file != NULL) {
+    fclose(world->delta_file);
+  }
+  free(world->delta_score);
+  if (world->live != NULL) {
+    live_close(world->live);
+    free(world->live);
+  }
+  if (world->lineage != NULL) {
+    lineage_close(world->lineage);
+    free(world->lineage);
+  }
+  if (world->transcript != NULL) {
+    transcript_close(world->transcript);
+    free(world->transcript);
+  }
+  if (world->tiles != NULL) {
+    tiles_close(world->tiles);
+    free(world->tiles);
+  }
+  population_destroy(&world->pop);
+  if (world->persist != NULL) {
+    persist_close(world->persist);
+    free(world->persist);
+  }
+  free(world->order);
+  if (world->play_nb != NULL) {
+    graph_destroy(world->play_nb);
+    graph_destroy(world->kill_nb);
+    graph_destroy(world->cross_nb);
+    free(world->play_nb);
+    free(world->kill_nb);
+    free(world->cross_nb);
+  }
+  graph_walk_destroy(&world->walk);
+  free(world->dirty);
+  free(world->kill_min);
+  free(world->kill_tmp);
+  free(world->covered);
+  free(world->surv_rank);
+  free(world->surv_x);
+  free(world->surv_row);
+  free(world->surv_cum);
+  if (world->genome_of != NULL) {
+    species_count_destroy(&world->genomes);
+    free(world->genome_of);
+  }
+  free(world->score_win);
+  if (world->species_of != NULL) {
+    species_count_destroy(&world->species);
+    free(world->species_of);
   }
-  free(world->pop);
   if (world->stat_file != NULL && world->stat_file != stdout) {
     fclose(world->stat_file);
   }
 }
 
-void world_reset(world_t *world) {
+static int mod(int x, int y) {
+  x %= y;
+  return x < 0 ? x + y : x;
+}
+
+static int min(int x, int y) {
+  return x < y ? x : y;
+}
+
+/* Computes out[i*stride] as the minimum of in[j*stride] over the cyclic
+ * window j in [i-k, i+k] (mod n), in constant time per element (van Herk,
+ * Gil and Werman). The buffer must hold 3*(n + 2*k) values. */
+static void cyclic_window_min(
+  int *out, const int *in, int n, int stride, int k, int *buf)
+{
+  if (2*k + 1 >= n) {
+    int m = in[0];
+    for (int i = 1; i < n; ++i) {
+      m = min(m, in[i*stride]);
+    }
+    for (int i = 0; i < n; ++i) {
+      out[i*stride] = m;
+    }
+    return;
+  }
+  int w   = 2*k + 1;
+  int len = n + 2*k;
+  int *ext = buf;
+  int *pre = buf + len;
+  int *suf = buf + 2*len;
+  for (int t = 0; t < len; ++t) {
+    ext[t] = in[mod(t - k, n) * stride];
+  }
+  /* prefix and suffix minima within blocks of length w */
+  for (int t = 0; t < len; ++t) {
+    pre[t] = (t % w == 0) ? ext[t] : min(pre[t-1], ext[t]);
+  }
+  for (int t = len - 1; t >= 0; --t) {
+    suf[t] = (t % w == w - 1 || t == len - 1) ? ext[t] : min(suf[t+1], ext[t]);
+  }
+  for (int i = 0; i < n; ++i) {
+    out[i*stride] = min(suf[i], pre[i + w - 1]);
+  }
+}
+
+/* Computes the minimum of in over the square area of radius k around each
+ * cell of the torus, through kill_tmp (out may be the same as in) */
+static void world_area_min(world_t *world, int *out, const int *in, int k) {
+  int size_x  = world->settings.board_size_x;
+  int size_y  = world->settings.board_size_y;
+  int buf_len = 3*((size_x > size_y ? size_x : size_y) + 2*k);
+  #pragma omp parallel
+  {
+    int *buf = malloc(sizeof(int) * buf_len);
+    #pragma omp for
+    for (int y = 0; y < size_y; ++y) {
+      cyclic_window_min(&world->kill_tmp[y * size_x],
+        &in[y * size_x], size_x, 1, k, buf);
+    }
+    #pragma omp for
+    for (int x = 0; x < size_x; ++x) {
+      cyclic_window_min(&out[x], &world->kill_tmp[x],
+        size_y, size_x, k, buf);
+    }
+    free(buf);
+  }
+}
+
+/* The same over the neighbourhoods of a graph, and the cell itself */
+static void world_area_min_graph(
+  world_t *world, const graph_t *nb, int *out, const int *in)
+{
+  #pragma omp parallel
+  {
+    graph_walk_t walk;
+    graph_walk_init(&walk);
+    #pragma omp for
+    for (int i = 0; i < board_size(world); ++i) {
+      const int *adj;
+      int        m = in[i];
+      int        n = graph_neighbours(nb, i, &walk, &adj);
+      for (int e = 0; e < n; ++e) {
+        m = min(m, in[adj[e]]);
+      }
+      out[i] = m;
+    }
+    graph_walk_destroy(&walk);
+  }
+}
+
+/* Deterministic automata without mistakes always play the same games, so
+ * only scores of automata with a newborn in their play area change */
+static int world_quiescent(const world_t *world) {
+  return (world->settings.flags & F_DETERMINISTIC)
+    && world->settings.mistake_rate == 0;
+}
+
+/* Marks automata whose scores have to be recomputed: those within the
+ * play area of an automaton born in the last step, and those chosen for
+ * the transcript, so that all their games are recorded */
+static void world_mark_dirty(world_t *world) {
+  int *born = world->kill_min;
+  #pragma omp parallel for
+  for (int i = 0; i < board_size(world); ++i) {
+    born[i] = -(world->pop.status[i] == A_ST_DEAD);
+  }
+  if (world->play_nb != NULL) {
+    world_area_min_graph(world, world->play_nb, world->dirty, born);
+  } else {
+    world_area_min(world, world->dirty, born, world->settings.play_area);
+  }
+  #pragma omp parallel for
   for (int i = 0; i < board_size(world); ++i) {
-    automaton_reset(&world->pop[i]);
+    world->dirty[i] = (world->dirty[i] < 0);
+  }
+  if (world->transcript != NULL && world->transcript->chosen != NULL) {
+    for (int i = 0; i < board_size(world); ++i) {
+      world->dirty[i] |= world->transcript->chosen[i];
+    }
   }
 }
 
-static int mod(int x, int y) {
-  x %= y;
-  return x < 0 ? x + y : x;
+void world_reset(world_t *world) {
+  if (world->persist != NULL) {
+    persist_touch(world->persist);
+  }
+  if (world_quiescent(world) && world->scores_valid) {
+    world_mark_dirty(world);
+  } else {
+    for (int i = 0; i < board_size(world); ++i) {
+      world->dirty[i] = 1;
+    }
+  }
+  population_reset(&world->pop, world->dirty);
+}
+
+/* Plays a game of i against j, recording it in the transcript */
+static int world_record_game(
+  world_t *world, int i, int j, MTRand *rand, int *score_j)
+{
+  transcript_t     *tr = world->transcript;
+  transcript_game_t game;
+  int score_i = automaton_game_traced(&world->pop, i, j, &world->settings,
+    rand, score_j, tr->turns);
+  game.step     = world->step;
+  game.id[0]    = world->pop.id[i];
+  game.id[1]    = world->pop.id[j];
+  game.cell[0]  = i;
+  game.cell[1]  = j;
+  game.turn_n   = world->settings.turn_n;
+  game.score[0] = score_i;
+  game.score[1] = *score_j;
+  game.reserved = 0;
+  transcript_write(tr, &game);
+  return score_i;
+}
+
+static void world_game(world_t *world, int i, int j) {
+  if (world->transcript == NULL
+    || !transcript_sampled(world->transcript, world->step, i, j))
+  {
+    automaton_play(&world->pop, i, j, &world->settings, &world->rand);
+    return;
+  }
+  int score_j;
+  world->pop.score[i] += world_record_game(world, i, j, &world->rand,
+    &score_j);
+  world->pop.score[j] += score_j;
+}
+
+/* Deterministic games are played from both sides, so each one is
+ * recorded from the side of the smaller cell, unless the other side
+ * does not replay it. Games are the same for every generator. */
+static int world_game_det(world_t *world, int i, int j) {
+  if (world->transcript == NULL || (j < i && world->dirty[j])
+    || !transcript_sampled(world->transcript, world->step, i, j))
+  {
+    return automaton_play_det(&world->pop, i, j, &world->settings);
+  }
+  int score_i;
+  int score_j;
+  #pragma omp critical (transcript)
+  {
+    score_i = world_record_game(world, i, j, &world->transcript->det_rand,
+      &score_j);
+  }
+  return score_i;
 }
 
 static void world_play_with(world_t *world, int x, int y) {
@@ -68,128 +497,452 @@ static void world_play_with(world_t *world, int x, int y) {
       int y2 = mod(y + dy, size_y);
       int j = y2 * size_x + x2;
       if (i != j) {
-        automaton_play(&world->pop[i], &world->pop[j],
-          &world->settings, &world->rand);
+        world_game(world, i, j);
       }
     }
   }
 }
 
-void world_play(world_t *world) {
-  for (int y = 0; y < world->settings.board_size_y; ++y) {
-    for (int x = 0; x < world->settings.board_size_x; ++x) {
-      world_play_with(world, x, y);
+static void world_play_graph(world_t *world, int i) {
+  const int *adj;
+  int n = graph_neighbours(world->play_nb, i, &world->walk, &adj);
+  for (int e = 0; e < n; ++e) {
+    world_game(world, i, adj[e]);
+  }
+}
+
+/* Plays the games of i in both roles, as the full phase does, but counts
+ * them only for i. Games of different automata are independent here. */
+static void world_play_det(world_t *world, int i, graph_walk_t *walk) {
+  int score = 0;
+  if (world->play_nb != NULL) {
+    const int *adj;
+    int n = graph_neighbours(world->play_nb, i, walk, &adj);
+    for (int e = 0; e < n; ++e) {
+      score += world_game_det(world, i, adj[e]);
+    }
+  } else {
+    int size_x    = world->settings.board_size_x;
+    int size_y    = world->settings.board_size_y;
+    int play_area = world->settings.play_area;
+    int x         = i % size_x;
+    int y         = i / size_x;
+    for (int dy = -play_area; dy <= play_area; ++dy) {
+      for (int dx = -play_area; dx <= play_area; ++dx) {
+        int j = mod(y + dy, size_y) * size_x + mod(x + dx, size_x);
+        if (i != j) {
+          score += world_game_det(world, i, j);
+        }
+      }
     }
   }
+  world->pop.score[i] = 2 * score;
 }
 
-static void world_kill_if_weak(world_t *world, int x, int y) {
+void world_play(world_t *world) {
   int size_x = world->settings.board_size_x;
-  int size_y = world->settings.board_size_y;
-  int i = y * size_x + x;
-  int kill_area = world->settings.kill_area;
-  if (world->pop[i].status != A_ST_ALIVE) {
-    return;
-  }
-  for (int dy = -kill_area; dy <= kill_area; ++dy) {
-    for (int dx = -kill_area; dx <= kill_area; ++dx) {
-      int x2 = mod(x + dx, size_x);
-      int y2 = mod(y + dy, size_y);
-      int j = y2 * size_x + x2;
-      if (world->pop[i].score > world->pop[j].score) {
-        world->pop[i].status = A_ST_STRONG;
-        return;
+  if (world_quiescent(world)) {
+    #pragma omp parallel
+    {
+      graph_walk_t walk;
+      graph_walk_init(&walk);
+      #pragma omp for schedule(dynamic, 64)
+      for (int t = 0; t < board_size(world); ++t) {
+        int i = world_cell(world, t);
+        if (world->dirty[i]) {
+          world_play_det(world, i, &walk);
+        }
       }
+      graph_walk_destroy(&walk);
     }
+    world->scores_valid = 1;
+    return;
   }
-  for (int dy = -kill_area; dy <= kill_area; ++dy) {
-    for (int dx = -kill_area; dx <= kill_area; ++dx) {
-      int x2 = mod(x + dx, size_x);
-      int y2 = mod(y + dy, size_y);
-      int j = y2 * size_x + x2;
-      world->pop[j].status = A_ST_SURVIVED;
+  for (int t = 0; t < board_size(world); ++t) {
+    int i = world_cell(world, t);
+    if (world->play_nb != NULL) {
+      world_play_graph(world, i);
+    } else {
+      world_play_with(world, i % size_x, i / size_x);
     }
   }
-  world->pop[i].status = A_ST_DEAD;
 }
 
-static void world_kill_if_old(world_t *world, int x, int y) {
-  int size_x = world->settings.board_size_x;
-  int size_y = world->settings.board_size_y;
-  int i = y * size_x + x;
-  int kill_area = world->settings.kill_area;
-  if (world->pop[i].status != A_ST_STRONG ||
-    world->pop[i].lifetime != 0)
-  {
+static int covered_words(const world_t *world) {
+  return (world->settings.board_size_x + 63) / 64;
+}
+
+static int is_covered(const world_t *world, int i) {
+  if (world->kill_nb != NULL) {
+    return (world->covered[i / 64] >> (i % 64)) & 1;
+  }
+  int x = i % world->settings.board_size_x;
+  int y = i / world->settings.board_size_x;
+  const uint64_t *row = &world->covered[y * covered_words(world)];
+  return (row[x / 64] >> (x % 64)) & 1;
+}
+
+static void cover_range(uint64_t *row, int lo, int hi) {
+  for (int w = lo / 64; w <= hi / 64; ++w) {
+    uint64_t mask = ~(uint64_t)0;
+    if (w == lo / 64) mask &= ~(uint64_t)0 << (lo % 64);
+    if (w == hi / 64) mask &= ~(uint64_t)0 >> (63 - hi % 64);
+    row[w] |= mask;
+  }
+}
+
+/* Marks the kill area around i as covered by a dead automaton */
+static void cover_kill_area(world_t *world, int i) {
+  if (world->kill_nb != NULL) {
+    const int *adj;
+    int n = graph_neighbours(world->kill_nb, i, &world->walk, &adj);
+    for (int e = 0; e < n; ++e) {
+      world->covered[adj[e] / 64] |= (uint64_t)1 << (adj[e] % 64);
+    }
     return;
   }
-  for (int dy = -kill_area; dy <= kill_area; ++dy) {
-    for (int dx = -kill_area; dx <= kill_area; ++dx) {
-      int x2 = mod(x + dx, size_x);
-      int y2 = mod(y + dy, size_y);
-      int j = y2 * size_x + x2;
-      world->pop[j].status = A_ST_SURVIVED;
+  int size_x    = world->settings.board_size_x;
+  int size_y    = world->settings.board_size_y;
+  int kill_area = world->settings.kill_area;
+  int words     = covered_words(world);
+  int x         = i % size_x;
+  int y         = i / size_x;
+  int rows      = 2*kill_area + 1 >= size_y ? size_y : 2*kill_area + 1;
+  for (int r = 0; r < rows; ++r) {
+    uint64_t *row = &world->covered[mod(y - kill_area + r, size_y) * words];
+    if (2*kill_area + 1 >= size_x) {
+      cover_range(row, 0, size_x - 1);
+    } else if (x - kill_area < 0) {
+      cover_range(row, 0, x + kill_area);
+      cover_range(row, x - kill_area + size_x, size_x - 1);
+    } else if (x + kill_area >= size_x) {
+      cover_range(row, x - kill_area, size_x - 1);
+      cover_range(row, 0, x + kill_area - size_x);
+    } else {
+      cover_range(row, x - kill_area, x + kill_area);
+    }
+  }
+}
+
+/* Automata around dead ones survive, others are strong */
+static void world_mark_survivors(world_t *world) {
+  #pragma omp parallel for
+  for (int i = 0; i < board_size(world); ++i) {
+    if (world->pop.status[i] != A_ST_DEAD) {
+      world->pop.status[i] =
+        is_covered(world, i) ? A_ST_SURVIVED : A_ST_STRONG;
+    }
+  }
+}
+
+/* Events are gathered in the batch of the thread, or appended at once if
+ * it is NULL */
+static void log_event(
+  world_t *world, lineage_batch_t *batch, int i, int event,
+  uint64_t parent1, uint64_t parent2)
+{
+  if (world->lineage != NULL) {
+    lineage_record_t rec = {
+      .step   = world->step,
+      .id     = world->pop.id[i],
+      .parent = { parent1, parent2 },
+      .hash   = world->pop.hash[i],
+      .cell   = i,
+      .event  = event
+    };
+    if (batch != NULL) {
+      lineage_push(world->lineage, batch, &rec);
+    } else {
+      lineage_append(world->lineage, &rec, 1);
     }
   }
-  world->pop[i].status = A_ST_DEAD;
 }
 
+static void log_flush(world_t *world, lineage_batch_t *batch) {
+  if (world->lineage != NULL) {
+    lineage_flush(world->lineage, batch);
+  }
+}
+
+static void world_kill(world_t *world, lineage_batch_t *batch, int i) {
+  world->pop.status[i] = A_ST_DEAD;
+  cover_kill_area(world, i);
+  log_event(world, batch, i, LINEAGE_DEATH, LINEAGE_NONE, LINEAGE_NONE);
+}
+
+/* An automaton dies if it has the lowest score in its kill area (or if it
+ * is too old), unless some automaton that died before it in raster order
+ * is within the kill area. Automata around dead ones survive, others are
+ * strong. Only the raster order selection is sequential: it touches the
+ * local minima and the dead automata alone. */
 void world_kill_weak(world_t *world) {
-  for (int y = 0; y < world->settings.board_size_y; ++y) {
-    for (int x = 0; x < world->settings.board_size_x; ++x) {
-      world_kill_if_weak(world, x, y);
+  lineage_batch_t batch;
+  lineage_batch_init(&batch);
+  memset(world->covered, 0, sizeof(uint64_t)
+    * covered_words(world) * world->settings.board_size_y);
+  if (world->kill_nb != NULL) {
+    world_area_min_graph(world, world->kill_nb, world->kill_min,
+      world->pop.score);
+  } else {
+    world_area_min(world, world->kill_min, world->pop.score,
+      world->settings.kill_area);
+  }
+  for (int i = 0; i < board_size(world); ++i) {
+    if (world->pop.score[i] <= world->kill_min[i] && !is_covered(world, i)) {
+      world_kill(world, &batch, i);
     }
   }
-  for (int y = 0; y < world->settings.board_size_y; ++y) {
-    for (int x = 0; x < world->settings.board_size_x; ++x) {
-      world_kill_if_old(world, x, y);
+  for (int i = 0; i < board_size(world); ++i) {
+    if (world->pop.lifetime[i] == 0 && !is_covered(world, i)) {
+      world_kill(world, &batch, i);
     }
   }
+  log_flush(world, &batch);
+  world_mark_survivors(world);
 }
 
-static int select_parent(world_t *world, int x, int y) {
+/* Number of survivors among cells a, a+1, ..., a+len-1 (mod size_x) of
+ * row y, counted with multiplicity if the range wraps more than once. */
+static long row_survivors(const world_t *world, int y, int a, int len) {
   int size_x = world->settings.board_size_x;
-  int size_y = world->settings.board_size_y;
+  int first  = world->surv_row[y];
+  int cnt    = world->surv_row[y+1] - first;
+  int b      = a + len % size_x;
+  long n     = (long)(len / size_x) * cnt;
+  int rank_a = world->surv_rank[y * size_x + a];
+  if (b < size_x) {
+    return n + world->surv_rank[y * size_x + b] - rank_a;
+  }
+  return n + cnt - rank_a + world->surv_rank[y * size_x + b - size_x];
+}
+
+/* Builds the index of survivors used to select parents. surv_rank holds
+ * the number of survivors preceding each cell in its row, surv_x lists
+ * their columns row by row, and surv_cum holds, for each column x, the
+ * running sum over rows of survivors in the cross area span of x. */
+static void world_index_survivors(world_t *world) {
+  int size_x     = world->settings.board_size_x;
+  int size_y     = world->settings.board_size_y;
   int cross_area = world->settings.cross_area;
-  int dx = genRandLong(&world->rand) % (2*cross_area + 1) - cross_area;
-  int dy = genRandLong(&world->rand) % (2*cross_area + 1) - cross_area;
-  int x2 = mod(x + dx, size_x);
-  int y2 = mod(y + dy, size_y);
-  int j = y2 * size_x + x2;
-  return (world->pop[j].status == A_ST_SURVIVED) ? j : -1;
+  #pragma omp parallel for
+  for (int y = 0; y < size_y; ++y) {
+    int n = 0;
+    for (int x = 0; x < size_x; ++x) {
+      world->surv_rank[y * size_x + x] = n;
+      n += (world->pop.status[y * size_x + x] == A_ST_SURVIVED);
+    }
+    world->surv_row[y+1] = n;
+  }
+  world->surv_row[0] = 0;
+  for (int y = 0; y < size_y; ++y) {
+    world->surv_row[y+1] += world->surv_row[y];
+  }
+  #pragma omp parallel for
+  for (int y = 0; y < size_y; ++y) {
+    int *list = &world->surv_x[world->surv_row[y]];
+    for (int x = 0; x < size_x; ++x) {
+      if (world->pop.status[y * size_x + x] == A_ST_SURVIVED) {
+        *list++ = x;
+      }
+    }
+    for (int x = 0; x < size_x; ++x) {
+      world->kill_tmp[y * size_x + x] = row_survivors(world, y,
+        mod(x - cross_area, size_x), 2*cross_area + 1);
+    }
+  }
+  for (int x = 0; x < size_x; ++x) {
+    world->surv_cum[x] = 0;
+  }
+  for (int y = 0; y < size_y; ++y) {
+    for (int x = 0; x < size_x; ++x) {
+      world->surv_cum[(y+1) * size_x + x] =
+        world->surv_cum[y * size_x + x] + world->kill_tmp[y * size_x + x];
+    }
+  }
+}
+
+/* Selects a survivor in the cross area of (x, y), uniformly over the
+ * cells of the area, or returns -1 if there is none. Rows of the area are
+ * found by binary search on surv_cum, and columns directly in surv_x. */
+static int select_parent(const world_t *world, int x, int y, MTRand *rand) {
+  int size_x     = world->settings.board_size_x;
+  int size_y     = world->settings.board_size_y;
+  int cross_area = world->settings.cross_area;
+  int len        = 2*cross_area + 1;
+  const int *cum = world->surv_cum;
+  int  b         = mod(y - cross_area, size_y);
+  long col_total = cum[size_y * size_x + x];
+  long area_n    = (long)(len / size_y) * col_total;
+  if (b + len % size_y < size_y) {
+    area_n += cum[(b + len % size_y) * size_x + x] - cum[b * size_x + x];
+  } else {
+    area_n += col_total - cum[b * size_x + x]
+      + cum[(b + len % size_y - size_y) * size_x + x];
+  }
+  if (area_n == 0) {
+    return -1;
+  }
+  /* position of the selected survivor in the cyclic sequence of survivors
+   * of the column span, starting at row b */
+  long pos = (cum[b * size_x + x] + (long)genRandBounded(rand, area_n))
+    % col_total;
+  int lo = 0;
+  int hi = size_y - 1;
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (cum[mid * size_x + x] <= pos) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  int  y2    = lo;
+  int  a     = mod(x - cross_area, size_x);
+  int  first = world->surv_row[y2];
+  int  cnt   = world->surv_row[y2+1] - first;
+  long rank  = world->surv_rank[y2 * size_x + a]
+    + (pos - cum[y2 * size_x + x]);
+  return y2 * size_x + world->surv_x[first + rank % cnt];
 }
 
+static int select_parent_graph(
+  const world_t *world, int i, MTRand *rand, graph_walk_t *walk)
+{
+  const int *adj;
+  int size = graph_neighbours(world->cross_nb, i, walk, &adj);
+  int n    = 0;
+  for (int e = 0; e < size; ++e) {
+    n += (world->pop.status[adj[e]] == A_ST_SURVIVED);
+  }
+  if (n == 0) {
+    return -1;
+  }
+  int r = genRandBounded(rand, n);
+  for (int e = 0; ; ++e) {
+    if (world->pop.status[adj[e]] == A_ST_SURVIVED && r-- == 0) {
+      return adj[e];
+    }
+  }
+}
+
+/* Each birth draws from its own SplitMix64 stream, keyed by the seed, the step and
+ * the cell, so the outcome does not depend on the order of births. */
+static uint64_t birth_key(const world_t *world, int i) {
+  uint64_t h = mix64(world->settings.seed);
+  h = mix64(h ^ world->step);
+  return mix64(h ^ (uint64_t)i);
+}
+
+/* Dead automata are replaced independently: parents are survivors, so
+ * they are never written here. */
 void world_spawn_new(world_t *world) {
-  for (int y = 0; y < world->settings.board_size_y; ++y) {
-    for (int x = 0; x < world->settings.board_size_x; ++x) {
-      int i = y * world->settings.board_size_x + x;
-      if (world->pop[i].status != A_ST_DEAD) {
+  int size_x = world->settings.board_size_x;
+  if (world->cross_nb == NULL) {
+    world_index_survivors(world);
+  }
+  unsigned long births = 0;
+  #pragma omp parallel
+  {
+    MTRand          rand;
+    graph_walk_t    walk;
+    lineage_batch_t batch;
+    graph_walk_init(&walk);
+    lineage_batch_init(&batch);
+    #pragma omp for schedule(dynamic, 256) reduction(+:births)
+    for (int t = 0; t < board_size(world); ++t) {
+      int i = world_cell(world, t);
+      if (world->pop.status[i] != A_ST_DEAD) {
         continue;
       }
+      int x = i % size_x;
+      int y = i / size_x;
+      keyRand(&rand, birth_key(world, i));
       int j, k;
-      do { j = select_parent(world, x, y); } while (j == -1);
-      do { k = select_parent(world, x, y); } while (k == -1 && j != k);
-      automaton_cross(&world->pop[i], &world->pop[j], &world->pop[k],
-        &world->settings, &world->rand);
+      if (world->cross_nb != NULL) {
+        j = select_parent_graph(world, i, &rand, &walk);
+        k = select_parent_graph(world, i, &rand, &walk);
+      } else {
+        j = select_parent(world, x, y, &rand);
+        k = select_parent(world, x, y, &rand);
+      }
+      if (j == -1) {
+        /* no survivors around: the dead automaton mutates itself */
+        j = k = i;
+      }
+      automaton_cross(&world->pop, i, j, k, &world->settings, &rand);
+      uint64_t parent1 = world->pop.id[j];
+      uint64_t parent2 = world->pop.id[k];
+      /* ids of births are unique, since each cell is born at most once
+       * per step, and do not depend on the order of births */
+      world->pop.id[i] = (world->step + 1) * board_size(world) + i;
+      log_event(world, &batch, i, LINEAGE_BIRTH, parent1, parent2);
+      births++;
     }
+    log_flush(world, &batch);
+    graph_walk_destroy(&walk);
   }
+  world->births = births;
+  world_update_counts(world);
 }
 
-static double avg_score(world_t *world) {
+/* Ids of immigrants have the top bit set, so they never collide with ids
+ * of births */
+#define IMMIGRANT_ID (UINT64_C(1) << 63)
+
+/* Replaces automaton i by one that came from another world, between
+ * steps. It is marked as born, so that the next step plays its games and
+ * it is counted like a birth. */
+void world_immigrate(
+  world_t        *world,
+  int             i,
+  const state_t  *genome,
+  unsigned        color,
+  unsigned short  lifetime,
+  uint64_t        id)
+{
+  population_t *pop = &world->pop;
+  if (world->persist != NULL) {
+    persist_touch(world->persist);
+  }
+  memcpy(pop->genome[i], genome, sizeof(state_t) * pop->state_n);
+  pop->color[i]    = color;
+  pop->lifetime[i] = lifetime;
+  pop->status[i]   = A_ST_DEAD;
+  pop->id[i]       = IMMIGRANT_ID
+    | ((uint64_t)world->step * board_size(world) + i);
+  automaton_compact(pop, i, &world->settings);
+  log_event(world, NULL, i, LINEAGE_BIRTH, id, id);
+  if (world->species_of != NULL && world->species_of[i] != pop->species[i])
+  {
+    species_count_add(&world->species, world->species_of[i], -1);
+    species_count_add(&world->species, pop->species[i], 1);
+    world->species_of[i] = pop->species[i];
+  }
+  if (world->genome_of != NULL) {
+    world_move_genome(world, i);
+  }
+}
+
+double world_avg_score(const world_t *world) {
   long sum = 0;
   for (int i = 0; i < board_size(world); ++i) {
-    sum += world->pop[i].score;
+    sum += world->pop.score[i];
   }
   return (double)sum / board_size(world);
 }
 
-static automaton_t *pick_example_automaton(world_t *world) {
-  int i;
+/* Examples are drawn from a stream of their own, keyed by the seed of the
+ * world and the step, so they leave the simulation alone and do not
+ * depend on other worlds running in the same process */
+static int pick_example_automaton(const world_t *world) {
+  MTRand rand;
+  int    i;
+  keyRand(&rand, mix64(mix64(world->settings.seed ^ 0x6578616d706c65ull)
+    ^ world->step));
   do {
-    /* we use different PRNG, in order to make simulation deterministic */
-    i = rand() % board_size(world);
-  } while (world->pop[i].status != A_ST_SURVIVED);
-  return &world->pop[i];
+    i = genRandBounded(&rand, board_size(world));
+  } while (world->pop.status[i] != A_ST_SURVIVED);
+  return i;
 }
 
 static void report_example_automaton(world_t *world) {
@@ -197,7 +950,8 @@ static void report_example_automaton(world_t *world) {
   sprintf(buf, "%s%lu.gv", world->settings.example_name, world->step);
   FILE *file = fopen(buf, "w");
   if (file) {
-    automaton_print(file, &world->settings, pick_example_automaton(world));
+    automaton_print(file, &world->settings, &world->pop,
+      pick_example_automaton(world));
     fclose(file);
   } else {
     error(0, errno, "cannot open file `%s'", buf);
@@ -205,7 +959,13 @@ static void report_example_automaton(world_t *world) {
   free(buf);
 }
 
-static void report_image(world_t *world) {
+static void report_image(const world_t *world) {
+  if (world->tiles != NULL) {
+    tiles_write(world->tiles, world);
+  }
+  if (world->settings.image_name == NULL) {
+    return;
+  }
   char title[64];
   char *fname = malloc(strlen(world->settings.image_name) + 32);
   sprintf(fname, "%s%lu.png", world->settings.image_name, world->step);
@@ -214,10 +974,81 @@ static void report_image(world_t *world) {
   free(fname);
 }
 
+/* Writes the image of the world now, regardless of the image rate */
+void world_report_image(const world_t *world) {
+  report_image(world);
+}
+
+/* The world is steady, when no births have brought a new genome or
+ * removed the last automaton of one (counts of the others keep drifting
+ * even in a frozen pattern), and the average score has stayed within the
+ * tolerance for the whole window. */
+static void world_detect_steady(world_t *world, double avg) {
+  int win = world->settings.steady_window;
+  if (win == 0) {
+    return;
+  }
+  int pos = world->step % win;
+  if (world->score_n == win) {
+    world->score_sum -= world->score_win[pos];
+    world->score_sq  -= world->score_win[pos] * world->score_win[pos];
+  } else {
+    world->score_n++;
+  }
+  world->score_win[pos] = avg;
+  world->score_sum += avg;
+  world->score_sq  += avg * avg;
+  if (pos == win - 1 && world->score_n == win) {
+    /* once per window, rounding errors of the running sums are dropped */
+    world->score_sum = world->score_sq = 0.0;
+    for (int k = 0; k < win; ++k) {
+      world->score_sum += world->score_win[k];
+      world->score_sq  += world->score_win[k] * world->score_win[k];
+    }
+  }
+
+  double mean = world->score_sum / win;
+  double var  = world->score_sq / win - mean * mean;
+  double tol  = (double)world->settings.steady_tolerance / 0x80000000ul;
+  world->steady = world->score_n == win
+    && world->step - world->hash_since + 1 >= (unsigned long)win
+    && var <= tol * tol * mean * mean;
+  if (world->steady && world->steady_step == ULONG_MAX) {
+    world->steady_step = world->step;
+    if (world->stat_file) {
+      fprintf(world->stat_file, "# steady state reached at step %lu\n",
+        world->step);
+    }
+    if ((world->settings.flags & F_QUIET) == 0) {
+      printf("\nsteady state reached at step %lu\n", world->step);
+    }
+  }
+}
+
+/* reports are made this many times less often in the steady state, when
+ * the policy is to throttle them */
+#define STEADY_THROTTLE_FACTOR 100
+
+static unsigned long report_rate(const world_t *world, int rate) {
+  if (world->steady && world->settings.steady_policy == STEADY_THROTTLE) {
+    return (unsigned long)rate * STEADY_THROTTLE_FACTOR;
+  }
+  return rate;
+}
+
 void world_report(world_t *world) {
+  double avg = world_avg_score(world);
+  world_detect_steady(world, avg);
   if (world->stat_file) {
-    if (world->step % world->settings.stat_report_rate == 0) {
-      fprintf(world->stat_file, "%lu\t%f\n", world->step, avg_score(world));
+    if (world->step % report_rate(world, world->settings.stat_report_rate)
+      == 0)
+    {
+      if (world->species_of != NULL) {
+        fprintf(world->stat_file, "%lu\t%f\t%d\n", world->step, avg,
+          world->species.n);
+      } else {
+        fprintf(world->stat_file, "%lu\t%f\n", world->step, avg);
+      }
     }
     unsigned long rs = world->step / world->settings.stat_report_rate;
     if (rs % world->settings.stat_flush_rate == 0) {
@@ -225,25 +1056,40 @@ void world_report(world_t *world) {
     }
   }
   if (world->settings.example_name != NULL
-    && world->step % world->settings.example_rate == 0)
+    && world->step % report_rate(world, world->settings.example_rate) == 0)
   {
     report_example_automaton(world);
   }
-  if (world->settings.image_name != NULL
-    && world->step % world->settings.image_rate == 0)
+  if ((world->settings.image_name != NULL || world->tiles != NULL)
+    && world->step % report_rate(world, world->settings.image_rate) == 0)
   {
     report_image(world);
   }
+  history_delta(world);
+  if (world->live != NULL) {
+    live_publish(world->live, world->step, avg, world->pop.score,
+      world->pop.color, world->pop.status);
+  }
   if ((world->settings.flags & F_QUIET) == 0) {
-    printf("\r%10lu: %10f", world->step, avg_score(world));
+    printf("\r%10lu: %10f", world->step, avg);
     fflush(stdout);
   }
 }
 
 int world_next_step(world_t *world) {
   world->step++;
-  return world->settings.step_n == 0
-      || world->step < world->settings.step_n;
+  if (world->steady && world->settings.steady_policy != STEADY_THROTTLE) {
+    if (world->settings.steady_policy == STEADY_BACKUP) {
+      world_serialize(world);
+    }
+    return 0;
+  }
+  int more = world->settings.step_n == 0
+          || world->step < world->settings.step_n;
+  if (more && world->step % world->settings.keyframe_rate == 0) {
+    history_keyframe(world);
+  }
+  return more;
 }
 
 #define TMP_WORLD_FILE ".world_new"
@@ -253,48 +1099,411 @@ static void world_serialize_main(FILE *file, const world_t *world) {
   serialize_tag(file, "WORLD");
   SERIALIZE_ULONG(file, world, step);
   for (int i = 0; i < board_size(world); ++i) {
-    automaton_serialize(file, &world->pop[i]);
+    automaton_serialize(file, &world->pop, i);
   }
 } 
 
-static void world_deserialize_main(FILE *file, world_t *world) {
+/* Reads what world_serialize_main and serializeRand wrote, from the mapped
+ * file. Automata are found by their tags first, and then read in
+ * parallel. */
+static void world_scan_main(FILE *file, world_t *world) {
+  scanner_t sc;
+  scanner_map(&sc, file);
+  scan_tag(&sc, "WORLD");
+  SCAN_ULONG(&sc, world, step, 0, ULONG_MAX);
+
+  int          n      = board_size(world);
+  const char **record = malloc(sizeof(const char *) * (n + 1));
+  const char  *pos    = sc.pos;
+  for (int i = 0; i < n && pos != NULL; ++i) {
+    record[i] = pos = scan_seek_tag(&sc, pos, "AUTOMATON");
+    pos = (pos == NULL ? NULL : pos + 1);
+  }
+  record[n] = (pos == NULL ? NULL : scan_seek_tag(&sc, pos, "RAND"));
+  if (record[n] == NULL) {
+    /* a broken file is read in order, to fail where deserialize would */
+    for (int i = 0; i < n; ++i) {
+      automaton_scan(&sc, &world->pop, i);
+    }
+    scanRand(&sc, &world->rand);
+  }
+  if (n > 0) {
+    /* only white space may be left before the first automaton */
+    scanner_t head = sc;
+    head.end = record[0];
+    if (!scan_done(&head)) {
+      error(EXIT_FAILURE, 0, "invalid world file (at tag AUTOMATON)");
+    }
+  }
+
+  /* threads only note errors, and the one of the first broken record is
+   * reported, as in a sequential read */
+  int  bad = n;
+  char failure[sizeof(sc.failure)];
+  #pragma omp parallel for schedule(dynamic, 256)
+  for (int i = 0; i < n; ++i) {
+    scanner_t rec = sc;
+    rec.pos = record[i];
+    rec.end = record[i + 1];
+    scan_defer(&rec);
+    automaton_scan(&rec, &world->pop, i);
+    if (rec.failure[0] == '\0' && !scan_done(&rec)) {
+      sprintf(rec.failure, "at tag %s", i + 1 < n ? "AUTOMATON" : "RAND");
+    }
+    if (rec.failure[0] != '\0') {
+      #pragma omp critical (scan_failure)
+      if (i < bad) {
+        bad = i;
+        strcpy(failure, rec.failure);
+      }
+      continue;
+    }
+    automaton_compact(&world->pop, i, &world->settings);
+  }
+  if (bad < n) {
+    error(EXIT_FAILURE, 0, "invalid world file (%s)", failure);
+  }
+
+  sc.pos = record[n];
+  scanRand(&sc, &world->rand);
+  free(record);
+  scanner_unmap(&sc);
+}
+
+/* Reads what world_serialize_main and serializeRand wrote with stdio, in
+ * order. It is slower than world_scan_main, and kept to check it. */
+static void world_read_main(FILE *file, world_t *world) {
   deserialize_tag(file, "WORLD");
   DESERIALIZE_ULONG(file, world, step, 0, ULONG_MAX);
   for (int i = 0; i < board_size(world); ++i) {
-    automaton_deserialize(file, &world->pop[i]);
+    automaton_deserialize(file, &world->pop, i);
+    automaton_compact(&world->pop, i, &world->settings);
   }
+  deserializeRand(file, &world->rand);
 }
 
-void world_serialize(const world_t *world) {
-  FILE *file = fopen(TMP_WORLD_FILE, "w");
-  if (file == NULL) {
-    error(0, errno, "cannot open world file `%s'", TMP_WORLD_FILE);
-    return;
-  }
-
+static void world_write(FILE *file, const world_t *world) {
   serialize_version(file, "trust_version", TRUST_VERSION);
   settings_serialize(file, &world->settings);
   world_serialize_main(file, world);
   serializeRand(file, &world->rand);
+}
+
+/* Writes the world to tmp_name first, and then moves it to name, so the
+ * previous file is kept if writing fails */
+void world_save(const world_t *world, const char *name, const char *tmp_name)
+{
+  FILE *file = fopen(tmp_name, "w");
+  if (file == NULL) {
+    error(0, errno, "cannot open world file `%s'", tmp_name);
+    return;
+  }
+
+  world_write(file, world);
 
   fclose(file);
-  if (rename(TMP_WORLD_FILE, WORLD_FILE)) {
-    error(0, errno, "cannot move world file to `%s'", WORLD_FILE);
+  if (rename(tmp_name, name)) {
+    error(0, errno, "cannot move world file to `%s'", name);
+  }
+}
+
+void world_serialize(const world_t *world) {
+  if (world->persist != NULL) {
+    persist_checkpoint(world->persist, world->step, &world->rand,
+      &world->settings);
+    return;
   }
+  world_save(world, WORLD_FILE, TMP_WORLD_FILE);
 }
 
 void world_deserialize(world_t *world) {
-  FILE *file = fopen(WORLD_FILE, "r");
+  world_load(world, WORLD_FILE);
+}
+
+void world_load(world_t *world, const char *name) {
+  FILE *file = fopen(name, "r");
   if (file == NULL) {
-    error(EXIT_FAILURE, errno, "cannot open world file `%s'", TMP_WORLD_FILE);
+    error(EXIT_FAILURE, errno, "cannot open world file `%s'", name);
     return;
   }
 
   deserialize_version(file, "trust_version", TRUST_VERSION);
   settings_deserialize(file, &world->settings);
+  /* world files are not written by persistent worlds */
+  world->settings.persist_name = NULL;
+  world->persist = NULL;
   world_basic_init(world, 1);
-  world_deserialize_main(file, world);
-  deserializeRand(file, &world->rand);
+  world_scan_main(file, world);
 
   fclose(file);
+  world_count_species(world);
+  world_count_genomes(world);
+  history_keyframe(world);
+}
+
+/* Restarts the persistent world from its last checkpoint. Automata are
+ * used where they are in the file, so nothing is read but the header. */
+void world_attach(world_t *world, const char *name) {
+  world->persist = malloc(sizeof(persist_t));
+  persist_open(world->persist, name, &world->settings);
+  persist_restore(world->persist,
+    population_layout(board_size(world), world->settings.state_n));
+  world_basic_init(world, 1);
+  world->step = world->persist->meta->step;
+  world->rand = world->persist->meta->rand;
+  world_count_species(world);
+  world_count_genomes(world);
+  history_keyframe(world);
+}
+
+/* History of the world is kept as keyframes NAME<n>.key, holding the
+ * same as the world file at step n, each followed by a file NAME<n>.dlt
+ * of deltas: for each step since, the cells whose scores changed, with
+ * their new scores (all scores are 0 at the keyframe), and automata born.
+ * Replay applies them, and plays no games. */
+static FILE *history_open(
+  const char *name, unsigned long step, const char *ext, const char *mode)
+{
+  char *fname = malloc(strlen(name) + 32);
+  sprintf(fname, "%s%lu.%s", name, step, ext);
+  FILE *file = fopen(fname, mode);
+  if (file == NULL && mode[0] == 'w') {
+    error(0, errno, "cannot open file `%s'", fname);
+  }
+  free(fname);
+  return file;
+}
+
+static void history_keyframe(world_t *world) {
+  const char *name = world->settings.history_name;
+  if (name == NULL) {
+    return;
+  }
+  FILE *file = history_open(name, world->step, "key", "w");
+  if (file != NULL) {
+    world_write(file, world);
+    fclose(file);
+  }
+  if (world->delta_file != NULL) {
+    fclose(world->delta_file);
+  }
+  world->delta_file = history_open(name, world->step, "dlt", "w");
+  memset(world->delta_score, 0, sizeof(int) * board_size(world));
+}
+
+static void history_delta(world_t *world) {
+  FILE *file = world->delta_file;
+  if (file == NULL) {
+    return;
+  }
+  /* cells and scores of changes are gathered in the kill buffers, which
+   * are free until the next step */
+  int *cell  = world->kill_min;
+  int *score = world->kill_tmp;
+  int  n     = 0;
+  for (int i = 0; i < board_size(world); ++i) {
+    if (world->pop.score[i] != world->delta_score[i]) {
+      cell[n]  = i;
+      score[n] = world->delta_score[i] = world->pop.score[i];
+      n++;
+    }
+  }
+  serialize_tag(file, "STEP");
+  SERIALIZE_ULONG(file, world, step);
+  serialize_int(file, "changed", n);
+  serialize_int_tab(file, "cells", cell, n);
+  serialize_int_tab(file, "scores", score, n);
+  SERIALIZE_ULONG(file, world, births);
+  for (int i = 0; i < board_size(world); ++i) {
+    if (world->pop.status[i] == A_ST_DEAD) {
+      serialize_int(file, "cell", i);
+      automaton_serialize(file, &world->pop, i);
+    }
+  }
+}
+
+/* Sets scores that changed in the step, and places automata born in it,
+ * which are marked dead (as before spawning) in the last step */
+static void history_apply_delta(world_t *world, FILE *file, int last) {
+  int *cell  = world->kill_min;
+  int *score = world->kill_tmp;
+  int  n;
+  deserialize_tag(file, "STEP");
+  DESERIALIZE_ULONG(file, world, step, world->step, world->step);
+  deserialize_int(file, "changed", &n, 0, board_size(world));
+  deserialize_int_tab(file, "cells", cell, n, 0, board_size(world) - 1);
+  deserialize_int_tab(file, "scores", score, n, INT_MIN, INT_MAX);
+  for (int k = 0; k < n; ++k) {
+    world->pop.score[cell[k]] = score[k];
+  }
+  DESERIALIZE_ULONG(file, world, births, 0, board_size(world));
+  for (unsigned long b = 0; b < world->births; ++b) {
+    int i;
+    deserialize_int(file, "cell", &i, 0, board_size(world) - 1);
+    automaton_deserialize(file, &world->pop, i);
+    automaton_compact(&world->pop, i, &world->settings);
+    if (last) {
+      world->pop.status[i] = A_ST_DEAD;
+    }
+  }
+}
+
+/* Finds the latest keyframe up to the given step. Keyframes are made every
+ * keyframe_rate steps, but also when the simulation is continued, so the
+ * directory is listed. */
+static int history_find_key(
+  const char *name, unsigned long step, unsigned long *key)
+{
+  const char *base  = strrchr(name, '/');
+  char       *dir   = malloc(strlen(name) + 1);
+  const char *dname = ".";
+  strcpy(dir, name);
+  if (base != NULL) {
+    dir[base - name + 1] = 0;
+    dname = dir;
+    base++;
+  } else {
+    base = name;
+  }
+  size_t len   = strlen(base);
+  int    found = 0;
+  DIR   *d     = opendir(dname);
+  struct dirent *e;
+  while (d != NULL && (e = readdir(d)) != NULL) {
+    unsigned long n;
+    char          ext[8];
+    char          end;
+    if (strncmp(e->d_name, base, len) != 0
+      || sscanf(e->d_name + len, "%lu.%7[a-z]%c", &n, ext, &end) != 2
+      || strcmp(ext, "key") != 0 || n > step)
+    {
+      continue;
+    }
+    if (!found || n > *key) {
+      *key  = n;
+      found = 1;
+    }
+  }
+  if (d != NULL) {
+    closedir(d);
+  }
+  free(dir);
+  return found;
+}
+
+/* Reads the header of a world file into a world that only gets looked at,
+ * so nothing is written for it */
+static void world_open_quiet(world_t *world, FILE *file) {
+  deserialize_version(file, "trust_version", TRUST_VERSION);
+  settings_deserialize(file, &world->settings);
+  world->settings.stat_file       = NULL;
+  world->settings.lineage_name    = NULL;
+  world->settings.history_name    = NULL;
+  world->settings.live_name       = NULL;
+  world->settings.tiles_name      = NULL;
+  world->settings.persist_name    = NULL;
+  world->settings.transcript_name = NULL;
+  world->settings.example_name    = NULL;
+  world->settings.image_name      = NULL;
+  world->persist                  = NULL;
+}
+
+/* Loads a world file with world_scan_main and with world_read_main into
+ * two worlds, and returns the first field where they differ, or NULL */
+const char *world_check_load(const char *name) {
+  world_t     w[2];
+  const char *diff = NULL;
+  for (int k = 0; k < 2; ++k) {
+    FILE *file = fopen(name, "r");
+    if (file == NULL) {
+      error(EXIT_FAILURE, errno, "cannot open world file `%s'", name);
+    }
+    settings_default(&w[k].settings);
+    world_open_quiet(&w[k], file);
+    world_basic_init(&w[k], 1);
+    if (k == 0) {
+      world_scan_main(file, &w[k]);
+    } else {
+      world_read_main(file, &w[k]);
+    }
+    fclose(file);
+  }
+
+  int    n = board_size(&w[0]);
+  size_t g = sizeof(state_t) * w[0].pop.state_n;
+  if (w[0].step != w[1].step) {
+    diff = "step";
+  } else if (memcmp(w[0].rand.mt, w[1].rand.mt, sizeof(w[0].rand.mt))
+    || w[0].rand.index != w[1].rand.index) {
+    diff = "RAND";
+  } else if (memcmp(w[0].pop.lifetime, w[1].pop.lifetime,
+    sizeof(unsigned short) * n)) {
+    diff = "lifetime";
+  } else if (memcmp(w[0].pop.color, w[1].pop.color, sizeof(unsigned) * n)) {
+    diff = "color";
+  } else if (memcmp(w[0].pop.id, w[1].pop.id, sizeof(uint64_t) * n)) {
+    diff = "id";
+  } else if (memcmp(w[0].pop.hash, w[1].pop.hash, sizeof(uint64_t) * n)) {
+    diff = "play tables";
+  }
+  for (int i = 0; diff == NULL && i < n; ++i) {
+    if (memcmp(w[0].pop.genome[i], w[1].pop.genome[i], g)) {
+      diff = "states";
+    }
+  }
+  world_destroy(&w[0]);
+  world_destroy(&w[1]);
+  return diff;
+}
+
+/* Reconstructs the world at the given step from the nearest keyframe and
+ * the deltas since, and reports its image and example automaton, named as
+ * in the current settings. Other settings come from the keyframe. */
+void world_replay(world_t *world, unsigned long step) {
+  settings_t  wanted = world->settings;
+  const char *name   = wanted.history_name;
+  unsigned long key  = 0;
+  FILE *file = NULL;
+  if (history_find_key(name, step, &key)) {
+    file = history_open(name, key, "key", "r");
+  }
+  if (file == NULL) {
+    error(EXIT_FAILURE, 0, "no keyframe up to step %lu in history `%s'",
+      step, name);
+  }
+
+  world_open_quiet(world, file);
+  world->settings.example_name = wanted.example_name;
+  world->settings.image_name   = wanted.image_name;
+  world_basic_init(world, 1);
+  world_scan_main(file, world);
+  fclose(file);
+  memset(world->pop.score, 0, sizeof(int) * board_size(world));
+  memset(world->pop.status, A_ST_ALIVE, board_size(world));
+
+  file = history_open(name, key, "dlt", "r");
+  if (file == NULL) {
+    error(EXIT_FAILURE, errno, "cannot open deltas of history `%s' at %lu",
+      name, key);
+  }
+  for (; world->step <= step; world->step++) {
+    history_apply_delta(world, file, world->step == step);
+  }
+  world->step = step;
+  fclose(file);
+
+  memset(world->covered, 0, sizeof(uint64_t)
+    * covered_words(world) * world->settings.board_size_y);
+  for (int i = 0; i < board_size(world); ++i) {
+    if (world->pop.status[i] == A_ST_DEAD) {
+      cover_kill_area(world, i);
+    }
+  }
+  world_mark_survivors(world);
+  if (world->settings.example_name != NULL) {
+    report_example_automaton(world);
+  }
+  if (world->settings.image_name != NULL) {
+    report_image(world);
+  }
 }
@@ -2,17 +2,70 @@
 #define __WORLD_H
 
 #include "automaton.h"
+#include "graph.h"
+#include "lineage.h"
+#include "live.h"
+#include "persist.h"
 #include "settings.h"
+#include "species.h"
+#include "tiles.h"
 #include "mtwister.h"
 
+#include <stdint.h>
 #include <stdio.h>
 
 typedef struct world {
   settings_t    settings;
   unsigned long step;
-  automaton_t  *pop;
+  population_t  pop;
   FILE         *stat_file;
   MTRand        rand;
+  int          *order;  /* traversal order of cells, NULL for raster */
+  lineage_t    *lineage;
+  FILE         *delta_file;  /* deltas since the last keyframe */
+  int          *delta_score; /* scores as of the last delta */
+  live_t       *live;
+  transcript_t *transcript;  /* sampled games */
+  tiles_t      *tiles;       /* image pyramid */
+  persist_t    *persist;     /* mapped file holding automata, or NULL */
+
+  /* neighbourhoods for topologies other than the torus */
+  graph_t      *play_nb;
+  graph_t      *kill_nb;
+  graph_t      *cross_nb;
+  graph_walk_t  walk;        /* for neighbourhoods visited serially */
+
+  /* automata whose scores are recomputed in the current step */
+  int          *dirty;
+  int           scores_valid;
+
+  /* buffers of the kill phase */
+  int          *kill_min;
+  int          *kill_tmp;
+  uint64_t     *covered;
+
+  /* index of survivors, for selection of parents */
+  int          *surv_rank;
+  int          *surv_x;
+  int          *surv_row;
+  int          *surv_cum;
+
+  /* behavioural species, counted when F_SPECIES_BEHAVE is set */
+  species_count_t species;
+  uint64_t     *species_of;  /* species each cell is counted in */
+
+  /* detection of the steady state */
+  unsigned long births;
+  uint64_t      genome_hash;  /* hash of the set of genomes present */
+  unsigned long hash_since;   /* step of the last change of the set */
+  species_count_t genomes;    /* numbers of automata of each genome */
+  uint64_t     *genome_of;    /* genome each cell is counted in, or NULL */
+  double       *score_win;    /* average scores of recent steps */
+  double        score_sum;
+  double        score_sq;
+  int           score_n;
+  int           steady;
+  unsigned long steady_step;  /* ULONG_MAX until it is first reached */
 } world_t;
 
 void world_init(world_t *world);
@@ -23,10 +76,24 @@ void world_play(world_t *world);
 void world_kill_weak(world_t *world);
 void world_spawn_new(world_t *world);
 void world_report(world_t *world);
+void world_report_image(const world_t *world);
+void world_immigrate(
+  world_t        *world,
+  int             i,
+  const state_t  *genome,
+  unsigned        color,
+  unsigned short  lifetime,
+  uint64_t        id);
+double world_avg_score(const world_t *world);
 
 int world_next_step(world_t *world);
 
 void world_serialize(const world_t *world);
 void world_deserialize(world_t *world);
+void world_save(const world_t *world, const char *name, const char *tmp_name);
+void world_load(world_t *world, const char *name);
+void world_attach(world_t *world, const char *name);
+void world_replay(world_t *world, unsigned long step);
+const char *world_check_load(const char *name);
 
 #endif
@@ -1,14 +1,26 @@
 #include "world_image.h"
 
+#include "species.h"
+
 #include <error.h>
 #include <errno.h>
-#include <png.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
 
-static void setRGB(png_bytep pixel, const world_t *world, int score) {
-  int area = world->settings.play_area;
+/* The score of a cell is mapped to the colour scale in units of half the
+ * payoff span per game turn */
+long image_score_unit(const world_t *world) {
+  long area = world->settings.play_area;
   area *= 2 + 1;
-  score *= 256;
-  score /= (2*area*area - 2)*world->settings.turn_n;
+  return payoff_span(&world->settings) * (area*area - 1)
+    * world->settings.turn_n;
+}
+
+void image_score_rgb(uint8_t *pixel, long unit, long score) {
+  score *= 512;
+  score /= unit;
   if (score < -255) {
     pixel[0] = 255;
     pixel[1] = 0;
@@ -36,90 +48,298 @@ static void setRGB(png_bytep pixel, const world_t *world, int score) {
   }
 }
 
-/* Based on Andrew Greensted's quick introduction to libPNG:
- * http://www.labbookpages.co.uk/software/imgProc/libPNG.html
- */
-void write_world_image(
-  const char    *fname,
-  const world_t *world,
-  char          *title)
+/* Uncompressed bands are about this large, so that there are enough of
+ * them to keep threads busy, and each still compresses well */
+#define BAND_SIZE (128 * 1024)
+
+#define BPP 3  /* bytes per pixel */
+
+void image_species_rgb(uint8_t *pixel, const world_t *world, int i) {
+  unsigned color = (world->settings.flags & F_SPECIES_BEHAVE
+    ? species_color(world->pop.simhash[i]) : world->pop.color[i]);
+  pixel[0] = color & 0xFF;
+  pixel[1] = (color >> 8) & 0xFF;
+  pixel[2] = (color >> 16) & 0xFF;
+}
+
+typedef struct image {
+  image_row_t    row;
+  const void    *data;
+  const settings_t *settings;
+  int            width;
+  int            height;
+  size_t         row_bytes;
+} image_t;
+
+static int paeth(int a, int b, int c) {
+  int p  = a + b - c;
+  int pa = abs(p - a);
+  int pb = abs(p - b);
+  int pc = abs(p - c);
+  if (pa <= pb && pa <= pc) return a;
+  if (pb <= pc) return b;
+  return c;
+}
+
+/* Writes the row filtered by the given PNG filter type (after the type
+ * byte) to out, and returns the sum of absolute values of the bytes */
+static long filter_row(
+  int type, const uint8_t *row, const uint8_t *prev, size_t n, uint8_t *out)
 {
-  FILE       *fp       = NULL;
-  png_structp png_ptr  = NULL;
-  png_infop   info_ptr = NULL;
-  png_bytep   row      = NULL;
-
-  do {
-    /* open file */
-    fp = fopen(fname, "wb");
-    if (fp == NULL) {
-      error(0, errno, "cannot open file `%s'", fname);
-      break;
+  long sum = 0;
+  out[0] = type;
+  for (size_t k = 0; k < n; ++k) {
+    int a = (k >= BPP ? row[k - BPP] : 0);
+    int b = prev[k];
+    int c = (k >= BPP ? prev[k - BPP] : 0);
+    int v;
+    switch (type) {
+    case PNG_FILTER_SUB:   v = row[k] - a;            break;
+    case PNG_FILTER_UP:    v = row[k] - b;            break;
+    case PNG_FILTER_AVG:   v = row[k] - (a + b) / 2;  break;
+    case PNG_FILTER_PAETH: v = row[k] - paeth(a, b, c); break;
+    default:               v = row[k];                break;
     }
+    out[k + 1] = (uint8_t)v;
+    sum += abs((int8_t)out[k + 1]);
+  }
+  return sum;
+}
 
-    /* initialize write structure */
-    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING,
-      NULL, NULL, NULL);
-    if (png_ptr == NULL) {
-      error(0, 0, "png_create_write_struct failed");
-      break;
+/* The adaptive filter picks the type giving the smallest sum of absolute
+ * values for each row, like libpng does */
+static void filter(
+  int type, const uint8_t *row, const uint8_t *prev, size_t n, uint8_t *out,
+  uint8_t *tmp)
+{
+  if (type != PNG_FILTER_ADAPTIVE) {
+    filter_row(type, row, prev, n, out);
+    return;
+  }
+  long best = filter_row(PNG_FILTER_NONE, row, prev, n, out);
+  for (int t = PNG_FILTER_SUB; t <= PNG_FILTER_PAETH; ++t) {
+    long sum = filter_row(t, row, prev, n, tmp);
+    if (sum < best) {
+      best = sum;
+      memcpy(out, tmp, n + 1);
     }
+  }
+}
 
-    /* initialize info structure */
-    info_ptr = png_create_info_struct(png_ptr);
-    if (info_ptr == NULL) {
-      error(0, 0, "png_create_info_struct failed");
-      break;
-    }
+typedef struct band {
+  int      y0;
+  int      y1;
+  uint8_t *data;   /* raw deflate data */
+  size_t   size;
+  uLong    adler;  /* of the uncompressed band */
+  size_t   length;
+} band_t;
 
-    /* setup exception handler */
-    if (setjmp(png_jmpbuf(png_ptr))) {
-      error(0, 0, "error during PNG creation");
-      break;
-    }
+/* Filters and compresses rows of the band into an independent raw deflate
+ * stream. It ends on a byte boundary without the final block (except for
+ * the last band), so streams of bands may be simply concatenated. */
+static int compress_band(const image_t *img, band_t *band, int last) {
+  const settings_t *settings = img->settings;
+  size_t   n     = img->row_bytes;
+  uint8_t *row   = malloc(n);
+  uint8_t *prev  = calloc(n, 1);
+  uint8_t *tmp   = malloc(n + 1);
+  size_t   len   = (size_t)(band->y1 - band->y0) * (n + 1);
+  uint8_t *raw   = malloc(len);
+  if (band->y0 > 0) {
+    img->row(img->data, band->y0 - 1, prev);
+  }
+  for (int y = band->y0; y < band->y1; ++y) {
+    img->row(img->data, y, row);
+    filter(settings->png_filter, row, prev, n,
+      &raw[(size_t)(y - band->y0) * (n + 1)], tmp);
+    uint8_t *t = prev;
+    prev = row;
+    row  = t;
+  }
+  free(row);
+  free(prev);
+  free(tmp);
 
-    int size_x  = world->settings.board_size_x;
-    int smap    = world->settings.flags & F_SPECIES_MAP;
-    int row_len = (smap ? 2 : 1);
-
-    png_init_io(png_ptr, fp);
-    png_set_IHDR(png_ptr, info_ptr,
-      row_len * size_x,
-      world->settings.board_size_y,
-      8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
-      PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
-
-    /* write title */
-    png_text title_text;
-    title_text.compression = PNG_TEXT_COMPRESSION_NONE;
-    title_text.key  = "Title";
-    title_text.text = title;
-    png_set_text(png_ptr, info_ptr, &title_text, 1);
-
-    png_write_info(png_ptr, info_ptr);
-
-    /* allocate memory for one row */
-    row = malloc(3 * row_len * size_x * sizeof(png_byte));
-
-    /* write data */
-    for (int y = 0; y < world->settings.board_size_y; y++) {
-      for (int x = 0; x < size_x; x++) {
-        int i = y * size_x + x;
-        setRGB(&row[x*3], world, world->pop[i].score);
-        if (smap) {
-          row[(x+size_x)*3 + 0] = world->pop[i].color & 0xFF;
-          row[(x+size_x)*3 + 1] = (world->pop[i].color >> 8) & 0xFF;
-          row[(x+size_x)*3 + 2] = (world->pop[i].color >> 16) & 0xFF;
-        }
+  band->length = len;
+  band->adler  = adler32(adler32(0L, Z_NULL, 0), raw, len);
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  int ret = deflateInit2(&zs, settings->png_level, Z_DEFLATED, -15, 8,
+    Z_DEFAULT_STRATEGY);
+  if (ret == Z_OK) {
+    band->data    = malloc(deflateBound(&zs, len) + 16);
+    zs.next_in    = raw;
+    zs.avail_in   = len;
+    zs.next_out   = band->data;
+    zs.avail_out  = deflateBound(&zs, len) + 16;
+    ret = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+    band->size = zs.total_out;
+    deflateEnd(&zs);
+    ret = (ret == (last ? Z_STREAM_END : Z_OK) ? Z_OK : Z_STREAM_ERROR);
+  } else {
+    band->data = NULL;
+  }
+  free(raw);
+  return ret;
+}
+
+static void put_u32(uint8_t *buf, uint32_t v) {
+  buf[0] = v >> 24;
+  buf[1] = v >> 16;
+  buf[2] = v >> 8;
+  buf[3] = v;
+}
+
+/* Writes a chunk, whose data are the concatenation of the given parts */
+static void write_chunk(
+  FILE *fp, const char *type, int parts, const uint8_t **data,
+  const size_t *size)
+{
+  uint8_t buf[4];
+  size_t  len = 0;
+  for (int p = 0; p < parts; ++p) {
+    len += size[p];
+  }
+  put_u32(buf, len);
+  fwrite(buf, 1, 4, fp);
+  fwrite(type, 1, 4, fp);
+  uLong crc = crc32(crc32(0L, Z_NULL, 0), (const Bytef *)type, 4);
+  for (int p = 0; p < parts; ++p) {
+    fwrite(data[p], 1, size[p], fp);
+    crc = crc32(crc, data[p], size[p]);
+  }
+  put_u32(buf, crc);
+  fwrite(buf, 1, 4, fp);
+}
+
+/* The PNG is written directly: horizontal bands are filtered and deflated
+ * in parallel, and their streams are joined in IDAT chunks, one per band,
+ * between the zlib header and the Adler-32 checksum combined from bands */
+int write_png(
+  const char       *fname,
+  int               width,
+  int               height,
+  const char       *title,
+  const settings_t *settings,
+  image_row_t       row,
+  const void       *data)
+{
+  image_t img;
+  img.row       = row;
+  img.data      = data;
+  img.settings  = settings;
+  img.width     = width;
+  img.height    = height;
+  img.row_bytes = (size_t)BPP * width;
+
+  int rows   = BAND_SIZE / img.row_bytes + 1;
+  int band_n = (img.height + rows - 1) / rows;
+  band_t *band = malloc(sizeof(band_t) * band_n);
+  int failed = 0;
+  #pragma omp parallel for schedule(dynamic) reduction(|:failed)
+  for (int b = 0; b < band_n; ++b) {
+    band[b].y0 = b * rows;
+    band[b].y1 = (b + 1 == band_n ? img.height : (b + 1) * rows);
+    failed |= (compress_band(&img, &band[b], b + 1 == band_n) != Z_OK);
+  }
+
+  FILE *fp = NULL;
+  if (failed) {
+    failed = 1;
+    error(0, 0, "cannot compress image `%s'", fname);
+  } else if ((fp = fopen(fname, "wb")) == NULL) {
+    error(0, errno, "cannot open file `%s'", fname);
+    failed = 1;
+  } else {
+    static const uint8_t signature[8] =
+      { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+    fwrite(signature, 1, 8, fp);
+
+    uint8_t ihdr[13];
+    put_u32(ihdr, img.width);
+    put_u32(ihdr + 4, img.height);
+    ihdr[8]  = 8;  /* bit depth */
+    ihdr[9]  = 2;  /* RGB */
+    ihdr[10] = 0;  /* deflate */
+    ihdr[11] = 0;  /* adaptive filtering */
+    ihdr[12] = 0;  /* no interlace */
+    const uint8_t *part[3] = { ihdr };
+    size_t         size[3] = { 13 };
+    write_chunk(fp, "IHDR", 1, part, size);
+
+    part[0] = (const uint8_t *)"Title";
+    size[0] = 6;  /* with the separating NUL */
+    part[1] = (const uint8_t *)title;
+    size[1] = strlen(title);
+    write_chunk(fp, "tEXt", 2, part, size);
+
+    /* zlib header for the given level, with the check bits */
+    int level  = settings->png_level;
+    int flevel = (level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3);
+    uint8_t zhead[2] = { 0x78, flevel << 6 };
+    zhead[1] += 31 - (zhead[0] * 256 + zhead[1]) % 31;
+    uLong   adler = adler32(0L, Z_NULL, 0);
+    uint8_t ztail[4];
+    for (int b = 0; b < band_n; ++b) {
+      int parts = 0;
+      if (b == 0) {
+        part[parts]   = zhead;
+        size[parts++] = 2;
       }
-      png_write_row(png_ptr, row);
+      part[parts]   = band[b].data;
+      size[parts++] = band[b].size;
+      adler = adler32_combine(adler, band[b].adler, band[b].length);
+      if (b + 1 == band_n) {
+        put_u32(ztail, adler);
+        part[parts]   = ztail;
+        size[parts++] = 4;
+      }
+      write_chunk(fp, "IDAT", parts, part, size);
+    }
+    write_chunk(fp, "IEND", 0, part, size);
+    if (fclose(fp) != 0) {
+      error(0, errno, "cannot write file `%s'", fname);
+      failed = 1;
     }
+  }
+  for (int b = 0; b < band_n; ++b) {
+    free(band[b].data);
+  }
+  free(band);
+  return (failed ? CHECK_FAIL : CHECK_OK);
+}
+
+typedef struct world_rows {
+  const world_t *world;
+  long           unit;
+  int            smap;
+} world_rows_t;
 
-    png_write_end(png_ptr, NULL);
-  } while (0);
+/* Draws row y of the image of the world: the map of scores, followed by
+ * the map of species, if it is enabled */
+static void world_row(const void *data, int y, uint8_t *row) {
+  const world_rows_t *wr     = data;
+  const world_t      *world  = wr->world;
+  int                 size_x = world->settings.board_size_x;
+  for (int x = 0; x < size_x; x++) {
+    int i = y * size_x + x;
+    image_score_rgb(&row[x*3], wr->unit, world->pop.score[i]);
+    if (wr->smap) {
+      image_species_rgb(&row[(x+size_x)*3], world, i);
+    }
+  }
+}
 
-  if (row != NULL)      free(row);
-  if (info_ptr != NULL) png_free_data(png_ptr, info_ptr, PNG_FREE_ALL, -1);
-  if (png_ptr != NULL)  png_destroy_write_struct(&png_ptr, NULL);
-  if (fp != NULL)       fclose(fp);
+void write_world_image(
+  const char    *fname,
+  const world_t *world,
+  char          *title)
+{
+  world_rows_t wr;
+  wr.world = world;
+  wr.unit  = image_score_unit(world);
+  wr.smap  = world->settings.flags & F_SPECIES_MAP;
+  write_png(fname, (wr.smap ? 2 : 1) * world->settings.board_size_x,
+    world->settings.board_size_y, title, &world->settings, world_row, &wr);
 }
@@ -3,6 +3,24 @@
 
 #include "world.h"
 
+#include <stdint.h>
+
+/* Draws row y of an image, as RGB bytes */
+typedef void (*image_row_t)(const void *data, int y, uint8_t *row);
+
+long image_score_unit(const world_t *world);
+void image_score_rgb(uint8_t *pixel, long unit, long score);
+void image_species_rgb(uint8_t *pixel, const world_t *world, int i);
+
+int write_png(
+  const char       *fname,
+  int               width,
+  int               height,
+  const char       *title,
+  const settings_t *settings,
+  image_row_t       row,
+  const void       *data);
+
 void write_world_image(
   const char    *fname,
   const world_t *world,